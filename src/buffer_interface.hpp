@@ -100,6 +100,33 @@ public:
         return (*this);
     }
 
+    // Zero copy access, only a contiguous block of at most maxContiguousSize() bytes can be
+    // reserved or peeked at once
+    uint8_t* reserve(int32_t sizeInBytes)
+    {
+        return _BufferImpl::reserve(sizeInBytes);
+    }
+
+    void commit(int32_t sizeInBytes)
+    {
+        _BufferImpl::commit(sizeInBytes);
+    }
+
+    const uint8_t* peek(int32_t sizeInBytes)
+    {
+        return _BufferImpl::peek(sizeInBytes);
+    }
+
+    void consume(int32_t sizeInBytes)
+    {
+        _BufferImpl::consume(sizeInBytes);
+    }
+
+    int32_t maxContiguousSize() const
+    {
+        return _BufferImpl::maxContiguousSize();
+    }
+
     int32_t emptySpace() const
     {
         return _BufferImpl::writableSize();
@@ -0,0 +1,709 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+#if defined(_WIN32)
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#endif
+
+#include "telemetry_protocol.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Capture files: what a session received, as it was received, so that it can be replayed later.
+//
+// Layout:
+//  - capture_file_header
+//  - chunks: capture_chunk_header followed by payloadSize bytes, the payload being frameCount times
+//    a uint64 (reception time in ns since the beginning of the capture) followed by a wire frame
+//  - a name table chunk, holding the clock_info and register_task frames needed to interpret any
+//    chunk on its own
+//  - the index: one capture_index_entry per chunk, name table excluded
+//  - capture_footer
+// The file is only ever appended to, the name table, index and footer are written when the capture
+// is closed. A file without footer (e.g. the server crashed) is still readable by walking the chunks
+// up to the first incomplete or corrupted one.
+//--------------------------------------------------------------------------------------------------
+static constexpr uint32_t capture_file_magic    = 0x4950514F; // "OQPI"
+static constexpr uint32_t capture_chunk_magic   = 0x4B4E4843; // "CHNK"
+static constexpr uint32_t capture_footer_magic  = 0x544F4F46; // "FOOT"
+static constexpr uint32_t capture_version       = 2;
+
+enum class capture_chunk_kind : uint16_t
+{
+    frames,
+    name_table,
+};
+
+struct capture_file_header
+{
+    uint32_t            magic           = capture_file_magic;
+    uint32_t            version         = capture_version;
+    uint64_t            reserved        = 0;
+};
+
+struct capture_chunk_header
+{
+    uint32_t            magic           = capture_chunk_magic;
+    capture_chunk_kind  kind            = capture_chunk_kind::frames;
+    uint16_t            reserved        = 0;
+    uint32_t            payloadSize     = 0;
+    uint32_t            frameCount      = 0;
+    uint32_t            checksum        = 0; // Of the payload
+    uint32_t            padding         = 0;
+    uint64_t            firstReceivedNs = 0;
+    uint64_t            lastReceivedNs  = 0;
+    // Range of the task timestamps found in the chunk, in ticks of the client's clock
+    uint64_t            minTicks        = UINT64_MAX;
+    uint64_t            maxTicks        = 0;
+};
+
+struct capture_index_entry
+{
+    uint64_t            offset;
+    uint64_t            firstReceivedNs;
+    uint64_t            minTicks;
+    uint64_t            maxTicks;
+};
+
+struct capture_footer
+{
+    uint64_t            indexOffset     = 0;
+    uint64_t            nameTableOffset = 0;
+    uint32_t            chunkCount      = 0;
+    uint32_t            magic           = capture_footer_magic;
+};
+
+// FNV-1a, good enough to detect torn writes and bit rot
+inline uint32_t capture_checksum(const uint8_t *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+// Range of the task timestamps of a frame, in ticks of the client's clock. Empty for frames without
+// tasks, in which case it leaves the range of a chunk as is.
+struct frame_tick_range
+{
+    uint64_t            minTicks        = UINT64_MAX;
+    uint64_t            maxTicks        = 0;
+
+    void add(const task_info &ti)
+    {
+        minTicks = std::min(minTicks, ti.startedAt);
+        maxTicks = std::max(maxTicks, ti.stoppedAt);
+    }
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Appends the frames of a session to a capture file. Frames are expected to have been validated
+// already, i.e. by telemetry::process, which also gives the range of their task timestamps.
+class capture_writer
+{
+public:
+    struct config
+    {
+        // Chunks are written once their payload reaches that size
+        size_t chunkSize = 1024 * 1024;
+    };
+
+public:
+    explicit capture_writer(const std::string &path)
+        : capture_writer(path, config())
+    {}
+
+    capture_writer(const std::string &path, const config &cfg)
+        : config_(cfg)
+        , pFile_(fopen(path.c_str(), "wb"))
+        , offset_(0)
+        , startTime_(std::chrono::steady_clock::now())
+    {
+        if (!pFile_)
+        {
+            throw std::runtime_error("cannot create capture file " + path);
+        }
+
+        // Nanoseconds until the client tells us otherwise, as for telemetry
+        clock_.ticksPerSecond = 1000000000ull;
+        write(capture_file_header());
+    }
+
+    ~capture_writer()
+    {
+        try
+        {
+            close();
+        }
+        catch (std::exception &)
+        {}
+    }
+
+    capture_writer(const capture_writer &) = delete;
+    capture_writer& operator=(const capture_writer &) = delete;
+
+    // tasks is the range of the task timestamps of the frame, computed when it was validated
+    void append(const uint8_t *frame, size_t size, const frame_tick_range &tasks)
+    {
+        const auto receivedNs = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime_).count());
+        if (!payload_.empty() && payload_.size() + sizeof(receivedNs) + size > config_.chunkSize)
+        {
+            writeChunk();
+        }
+
+        track(frame);
+        chunk_.minTicks = std::min(chunk_.minTicks, tasks.minTicks);
+        chunk_.maxTicks = std::max(chunk_.maxTicks, tasks.maxTicks);
+        appendFrame(receivedNs, frame, size);
+    }
+
+    // Writes the pending chunk, the name table, the index and the footer
+    void close()
+    {
+        if (!pFile_)
+        {
+            return;
+        }
+
+        try
+        {
+            if (!payload_.empty())
+            {
+                writeChunk();
+            }
+
+            capture_footer footer;
+            footer.nameTableOffset = offset_;
+            footer.chunkCount = uint32_t(index_.size());
+            writeNameTable();
+
+            footer.indexOffset = offset_;
+            for (const auto &entry : index_)
+            {
+                write(entry);
+            }
+            write(footer);
+        }
+        catch (std::exception &)
+        {
+            fclose(pFile_);
+            pFile_ = nullptr;
+            throw;
+        }
+
+        auto *pFile = pFile_;
+        pFile_ = nullptr;
+        if (fclose(pFile) != 0)
+        {
+            throw std::runtime_error("cannot close capture file");
+        }
+    }
+
+private:
+    // Keeps what the name table needs
+    void track(const uint8_t *frame)
+    {
+        frame_header header;
+        memcpy(&header, frame, sizeof(header));
+        auto offset = sizeof(header);
+
+        switch (header.op)
+        {
+        case opcode::clock_info:
+            memcpy(&clock_, frame + offset, sizeof(clock_));
+            break;
+
+        case opcode::register_task:
+            for (uint32_t i = 0; i < header.recordCount; ++i)
+            {
+                name_record nr;
+                memcpy(&nr, frame + offset, sizeof(nr));
+                offset += sizeof(nr);
+                if (nr.nameId >= names_.size())
+                {
+                    names_.resize(nr.nameId + 1);
+                }
+                names_[nr.nameId].assign((const char*)frame + offset, nr.length);
+                offset += nr.length;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    void appendFrame(uint64_t receivedNs, const uint8_t *frame, size_t size)
+    {
+        if (chunk_.frameCount == 0)
+        {
+            chunk_.firstReceivedNs = receivedNs;
+        }
+        chunk_.lastReceivedNs = receivedNs;
+        ++chunk_.frameCount;
+
+        const auto offset = payload_.size();
+        payload_.resize(offset + sizeof(receivedNs) + size);
+        memcpy(payload_.data() + offset, &receivedNs, sizeof(receivedNs));
+        memcpy(payload_.data() + offset + sizeof(receivedNs), frame, size);
+    }
+
+    void writeChunk()
+    {
+        chunk_.payloadSize = uint32_t(payload_.size());
+        chunk_.checksum = capture_checksum(payload_.data(), payload_.size());
+        if (chunk_.kind == capture_chunk_kind::frames)
+        {
+            index_.push_back(capture_index_entry{ offset_, chunk_.firstReceivedNs, chunk_.minTicks, chunk_.maxTicks });
+        }
+
+        write(chunk_);
+        writeBytes(payload_.data(), payload_.size());
+
+        const auto kind = chunk_.kind;
+        chunk_ = capture_chunk_header();
+        chunk_.kind = kind;
+        payload_.clear();
+    }
+
+    void writeNameTable()
+    {
+        chunk_ = capture_chunk_header();
+        chunk_.kind = capture_chunk_kind::name_table;
+
+        std::vector<uint8_t> frame;
+        frame_header header;
+        header.op = opcode::clock_info;
+        header.recordCount = 1;
+        header.size = uint32_t(sizeof(header) + sizeof(clock_));
+        frame.resize(header.size);
+        memcpy(frame.data(), &header, sizeof(header));
+        memcpy(frame.data() + sizeof(header), &clock_, sizeof(clock_));
+        appendFrame(0, frame.data(), frame.size());
+
+        // Split in as many frames as needed
+        for (uint32_t nameId = 0; nameId < names_.size();)
+        {
+            frame.resize(sizeof(header));
+            header = frame_header();
+            header.op = opcode::register_task;
+            for (; nameId < names_.size(); ++nameId)
+            {
+                const auto &name = names_[nameId];
+                if (frame.size() + sizeof(name_record) + name.size() > max_frame_size)
+                {
+                    break;
+                }
+
+                name_record nr;
+                nr.nameId = nameId;
+                nr.length = uint16_t(name.size());
+                const auto offset = frame.size();
+                frame.resize(offset + sizeof(nr) + nr.length);
+                memcpy(frame.data() + offset, &nr, sizeof(nr));
+                memcpy(frame.data() + offset + sizeof(nr), name.data(), nr.length);
+                ++header.recordCount;
+            }
+            header.size = uint32_t(frame.size());
+            memcpy(frame.data(), &header, sizeof(header));
+            appendFrame(0, frame.data(), frame.size());
+        }
+
+        writeChunk();
+    }
+
+    template<typename T>
+    void write(const T &t)
+    {
+        writeBytes(&t, sizeof(T));
+    }
+
+    void writeBytes(const void *data, size_t size)
+    {
+        if (fwrite(data, 1, size, pFile_) != size)
+        {
+            throw std::runtime_error("cannot write to capture file");
+        }
+        offset_ += size;
+    }
+
+private:
+    const config                        config_;
+    FILE                                *pFile_;
+    uint64_t                            offset_;
+    std::chrono::steady_clock::time_point startTime_;
+    capture_chunk_header                chunk_;
+    std::vector<uint8_t>                payload_;
+    std::vector<capture_index_entry>    index_;
+    std::vector<std::string>            names_;
+    clock_record                        clock_;
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Read only mapping of a whole file
+class mapped_file
+{
+public:
+    explicit mapped_file(const std::string &path)
+    {
+#if defined(_WIN32)
+        hFile_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER size;
+        if (hFile_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile_, &size))
+        {
+            throw std::runtime_error("cannot open " + path);
+        }
+
+        size_ = size_t(size.QuadPart);
+        if (size_ > 0)
+        {
+            hMapping_ = CreateFileMappingA(hFile_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            pData_ = hMapping_ ? (const uint8_t*)MapViewOfFile(hMapping_, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        }
+#else
+        fd_ = open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd_ < 0 || fstat(fd_, &st) != 0)
+        {
+            throw std::runtime_error("cannot open " + path);
+        }
+
+        size_ = size_t(st.st_size);
+        if (size_ > 0)
+        {
+            auto *pMapping = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+            pData_ = (pMapping != MAP_FAILED) ? (const uint8_t*)pMapping : nullptr;
+        }
+#endif
+        if (size_ > 0 && !pData_)
+        {
+            unmap();
+            throw std::runtime_error("cannot map " + path);
+        }
+    }
+
+    ~mapped_file()
+    {
+        unmap();
+    }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file& operator=(const mapped_file &) = delete;
+
+    const uint8_t* data() const { return pData_; }
+    size_t size() const         { return size_; }
+
+private:
+    void unmap()
+    {
+#if defined(_WIN32)
+        if (pData_) UnmapViewOfFile(pData_);
+        if (hMapping_) CloseHandle(hMapping_);
+        if (hFile_ != INVALID_HANDLE_VALUE) CloseHandle(hFile_);
+#else
+        if (pData_) munmap((void*)pData_, size_);
+        if (fd_ >= 0) ::close(fd_);
+#endif
+    }
+
+private:
+#if defined(_WIN32)
+    HANDLE          hFile_      = INVALID_HANDLE_VALUE;
+    HANDLE          hMapping_   = nullptr;
+#else
+    int             fd_         = -1;
+#endif
+    const uint8_t   *pData_     = nullptr;
+    size_t          size_       = 0;
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Maps a capture file, opening it only reads the footer and the index. Frames are handed out as
+// views in the mapping and chunks are only checked when read.
+class capture_reader
+{
+public:
+    explicit capture_reader(const std::string &path)
+        : file_(path)
+        , nameTableOffset_(0)
+    {
+        capture_file_header header;
+        if (file_.size() < sizeof(header))
+        {
+            throw std::runtime_error("not a capture file: " + path);
+        }
+
+        memcpy(&header, file_.data(), sizeof(header));
+        if (header.magic != capture_file_magic || header.version != capture_version)
+        {
+            throw std::runtime_error("not a capture file: " + path);
+        }
+
+        if (!readIndex())
+        {
+            scanChunks();
+        }
+    }
+
+    // Chunks of frames, by order of reception
+    size_t chunkCount() const
+    {
+        return chunks_.size();
+    }
+
+    capture_chunk_header chunkHeader(size_t index) const
+    {
+        return read<capture_chunk_header>(chunks_[index].offset);
+    }
+
+    // Where a chunk is and the range of its task timestamps, empty (minTicks > maxTicks) for chunks
+    // without tasks
+    const capture_index_entry& chunkEntry(size_t index) const
+    {
+        return chunks_[index];
+    }
+
+    // Earliest task timestamp of the capture, UINT64_MAX if it holds no task
+    uint64_t firstTicks() const
+    {
+        auto ticks = UINT64_MAX;
+        for (const auto &entry : chunks_)
+        {
+            ticks = std::min(ticks, entry.minTicks);
+        }
+        return ticks;
+    }
+
+    // First chunk holding a task that stops at or after the given time, chunkCount() if none does.
+    // Chunks are ordered by reception, so later chunks may still hold earlier tasks: replaying from
+    // there gives every task stopping from that time on, and possibly a few before.
+    size_t firstChunkAt(uint64_t ticks) const
+    {
+        for (size_t i = 0; i < chunks_.size(); ++i)
+        {
+            if (chunks_[i].minTicks <= chunks_[i].maxTicks && chunks_[i].maxTicks >= ticks)
+            {
+                return i;
+            }
+        }
+        return chunks_.size();
+    }
+
+    // Frequency of the client's clock, as found in the name table, 0 without name table
+    uint64_t ticksPerSecond() const
+    {
+        uint64_t ticksPerSecond = 0;
+        forEachNameTableFrame([&ticksPerSecond](uint64_t, const uint8_t *data, size_t size)
+        {
+            frame_header header;
+            memcpy(&header, data, sizeof(header));
+            if (header.op == opcode::clock_info && size >= sizeof(header) + sizeof(clock_record))
+            {
+                clock_record cr;
+                memcpy(&cr, data + sizeof(header), sizeof(cr));
+                ticksPerSecond = cr.ticksPerSecond;
+            }
+        });
+        return ticksPerSecond;
+    }
+
+    // False for captures that weren't closed properly, only the chunks received before and their
+    // own names are available then
+    bool hasNameTable() const
+    {
+        return nameTableOffset_ != 0;
+    }
+
+    // Calls f(receivedNs, frameData, frameSize) for each frame of the given chunk, throws if the chunk
+    // is corrupted
+    template<typename _F>
+    void forEachFrame(size_t index, _F &&f) const
+    {
+        forEachFrameAt(chunks_[index].offset, f);
+    }
+
+    // Same for the clock_info and register_task frames of the name table
+    template<typename _F>
+    void forEachNameTableFrame(_F &&f) const
+    {
+        if (hasNameTable())
+        {
+            forEachFrameAt(nameTableOffset_, f);
+        }
+    }
+
+private:
+    bool readIndex()
+    {
+        capture_footer footer;
+        if (file_.size() < sizeof(capture_file_header) + sizeof(footer))
+        {
+            return false;
+        }
+
+        footer = read<capture_footer>(file_.size() - sizeof(footer));
+        const auto indexEnd = file_.size() - sizeof(footer);
+        const auto indexSize = uint64_t(footer.chunkCount) * sizeof(capture_index_entry);
+        if (footer.magic != capture_footer_magic || footer.indexOffset > indexEnd
+            || indexEnd - footer.indexOffset != indexSize)
+        {
+            return false;
+        }
+
+        // A footer that looks fine doesn't make the offsets it leads to right, the chunks are scanned
+        // instead of trusting any of them
+        if (footer.nameTableOffset != 0 && !isChunkOffset(footer.nameTableOffset))
+        {
+            return false;
+        }
+
+        chunks_.reserve(footer.chunkCount);
+        for (uint32_t i = 0; i < footer.chunkCount; ++i)
+        {
+            const auto entry = read<capture_index_entry>(footer.indexOffset + i * sizeof(capture_index_entry));
+            if (!isChunkOffset(entry.offset))
+            {
+                chunks_.clear();
+                return false;
+            }
+            chunks_.push_back(entry);
+        }
+        nameTableOffset_ = footer.nameTableOffset;
+        return true;
+    }
+
+    // Past the file header, with room for a whole chunk header
+    bool isChunkOffset(uint64_t offset) const
+    {
+        return offset >= sizeof(capture_file_header) && file_.size() >= sizeof(capture_chunk_header)
+            && offset <= file_.size() - sizeof(capture_chunk_header);
+    }
+
+    void scanChunks()
+    {
+        uint64_t offset = sizeof(capture_file_header);
+        while (offset + sizeof(capture_chunk_header) <= file_.size())
+        {
+            const auto header = read<capture_chunk_header>(offset);
+            const auto end = offset + sizeof(header) + header.payloadSize;
+            if (header.magic != capture_chunk_magic || end > file_.size()
+                || header.checksum != capture_checksum(file_.data() + offset + sizeof(header), header.payloadSize))
+            {
+                break;
+            }
+
+            if (header.kind == capture_chunk_kind::frames)
+            {
+                chunks_.push_back(capture_index_entry{ offset, header.firstReceivedNs, header.minTicks, header.maxTicks });
+            }
+            offset = end;
+        }
+    }
+
+    template<typename _F>
+    void forEachFrameAt(uint64_t offset, _F &f) const
+    {
+        const auto header = read<capture_chunk_header>(offset);
+        const auto *payload = file_.data() + offset + sizeof(header);
+        if (header.magic != capture_chunk_magic || header.payloadSize > file_.size() - offset - sizeof(header)
+            || header.checksum != capture_checksum(payload, header.payloadSize))
+        {
+            throw std::runtime_error("corrupted capture chunk");
+        }
+
+        size_t position = 0;
+        for (uint32_t i = 0; i < header.frameCount; ++i)
+        {
+            uint64_t receivedNs;
+            uint32_t frameSize;
+            if (position + sizeof(receivedNs) + sizeof(frame_header) > header.payloadSize)
+            {
+                throw std::runtime_error("corrupted capture chunk");
+            }
+
+            memcpy(&receivedNs, payload + position, sizeof(receivedNs));
+            position += sizeof(receivedNs);
+            memcpy(&frameSize, payload + position, sizeof(frameSize));
+            if (frameSize < sizeof(frame_header) || position + frameSize > header.payloadSize)
+            {
+                throw std::runtime_error("corrupted capture chunk");
+            }
+
+            f(receivedNs, payload + position, size_t(frameSize));
+            position += frameSize;
+        }
+    }
+
+    template<typename T>
+    T read(uint64_t offset) const
+    {
+        if (offset > file_.size() || sizeof(T) > file_.size() - offset)
+        {
+            throw std::runtime_error("corrupted capture chunk");
+        }
+
+        T t;
+        memcpy(&t, file_.data() + offset, sizeof(T));
+        return t;
+    }
+
+private:
+    mapped_file                         file_;
+    std::vector<capture_index_entry>    chunks_;
+    uint64_t                            nameTableOffset_;
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Feeds the frames of a capture to process(data, size), either as fast as possible or with the
+// timing they were received with. Replaying from a chunk other than the first one starts with the
+// name table, so that the names and the clock are known.
+template<typename _Process>
+void replay_capture(const capture_reader &reader, _Process &&process, bool realTime, size_t firstChunk = 0)
+{
+    if (firstChunk > 0)
+    {
+        reader.forEachNameTableFrame([&process](uint64_t, const uint8_t *data, size_t size)
+        {
+            process(data, size);
+        });
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto firstReceivedNs = UINT64_MAX;
+    for (auto i = firstChunk; i < reader.chunkCount(); ++i)
+    {
+        reader.forEachFrame(i, [&](uint64_t receivedNs, const uint8_t *data, size_t size)
+        {
+            if (realTime)
+            {
+                firstReceivedNs = std::min(firstReceivedNs, receivedNs);
+                std::this_thread::sleep_until(start + std::chrono::nanoseconds(receivedNs - firstReceivedNs));
+            }
+            process(data, size);
+        });
+    }
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include "telemetry_protocol.hpp"
+#include "frame_decoder.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Converts a stream of wire frames to the Chrome trace event JSON format, which chrome://tracing,
+// Perfetto and most trace viewers open.
+// Each task becomes a complete ("X") event on the thread it started on, with its core, uid, parent
+// group and, when known, time spent in the queue of the scheduler in its args. Tasks are linked to
+// their group with flow events: the group's slice binds its uid as a flow out, the slices of its
+// tasks bind the same id as a flow in. A slice only binds a single flow, nested groups are thus only
+// linked to their own tasks.
+// Steals are instant events on the thread of the thief.
+// Events are written as records are processed, only the names and the groups not done yet are kept:
+// memory does not depend on the length of the stream.
+class chrome_trace_writer
+{
+public:
+    explicit chrome_trace_writer(std::ostream &os, uint32_t processId = 1)
+        : os_(os)
+        , processId_(processId)
+        , eventCount_(0)
+        , finished_(false)
+    {
+        os_ << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    }
+
+    ~chrome_trace_writer()
+    {
+        finish();
+    }
+
+    chrome_trace_writer(const chrome_trace_writer &) = delete;
+    chrome_trace_writer& operator=(const chrome_trace_writer &) = delete;
+
+    // Decodes a whole frame, header included, throws if it is malformed
+    void process(const uint8_t *data, size_t size)
+    {
+        struct visitor
+        {
+            chrome_trace_writer &w;
+
+            void onClock(const clock_record &cr)
+            {
+                w.ticksPerSecond_ = cr.ticksPerSecond;
+            }
+
+            void onName(uint32_t nameId, const char *name, uint16_t length)
+            {
+                if (nameId >= w.names_.size())
+                {
+                    w.names_.resize(nameId + 1);
+                }
+                w.names_[nameId] = escape(name, length);
+            }
+
+            void onGroup(const group_info &gi)
+            {
+                w.openGroups_.insert(gi.uid);
+            }
+
+            void onTask(const task_info &ti)
+            {
+                w.writeTask(ti);
+            }
+
+            void onSteal(const steal_info &si)
+            {
+                w.writeSteal(si);
+            }
+
+            // Nothing to draw, the trace simply misses these tasks
+            void onDropped(const dropped_info &)
+            {}
+        };
+
+        visitor v{ *this };
+        decoder_.decode(data, size, v);
+    }
+
+    // Closes the JSON document, nothing can be written afterwards
+    void finish()
+    {
+        if (finished_)
+        {
+            return;
+        }
+
+        finished_ = true;
+        os_ << "\n]}\n";
+        os_.flush();
+    }
+
+    uint64_t eventCount() const
+    {
+        return eventCount_;
+    }
+
+private:
+    void writeTask(const task_info &ti)
+    {
+        const auto startNs = ticks_to_nanoseconds(ti.startedAt, ticksPerSecond_);
+        const auto stopNs = ticks_to_nanoseconds(ti.stoppedAt, ticksPerSecond_);
+        const auto durationNs = stopNs > startNs ? stopNs - startNs : 0;
+
+        line_.clear();
+        line_ += eventCount_++ > 0 ? ",\n{\"name\":\"" : "\n{\"name\":\"";
+        if (ti.nameId < names_.size())
+        {
+            line_ += names_[ti.nameId];
+        }
+        else
+        {
+            line_ += "task " + std::to_string(ti.nameId);
+        }
+
+        char buffer[512];
+        snprintf(buffer, sizeof(buffer),
+            "\",\"ph\":\"X\",\"pid\":%u,\"tid\":%llu,\"ts\":%llu.%03u,\"dur\":%llu.%03u"
+            ",\"args\":{\"core\":%u,\"uid\":%llu,\"parent\":%llu",
+            processId_, (unsigned long long)ti.startedOnThread,
+            (unsigned long long)(startNs / 1000), unsigned(startNs % 1000),
+            (unsigned long long)(durationNs / 1000), unsigned(durationNs % 1000),
+            unsigned(ti.startedOnCore), (unsigned long long)ti.uid, (unsigned long long)ti.groupUID);
+        line_ += buffer;
+
+        // Time spent in the queue of the scheduler, when known
+        if (ti.scheduledAt != not_scheduled && ti.scheduledAt <= ti.startedAt)
+        {
+            const auto waitNs = ticks_to_nanoseconds(ti.startedAt - ti.scheduledAt, ticksPerSecond_);
+            snprintf(buffer, sizeof(buffer), ",\"queued_us\":%llu.%03u",
+                (unsigned long long)(waitNs / 1000), unsigned(waitNs % 1000));
+            line_ += buffer;
+        }
+        line_ += "}";
+
+        // A group is done once its own record is in, its tasks were all sent before
+        if (openGroups_.erase(ti.uid) > 0)
+        {
+            snprintf(buffer, sizeof(buffer), ",\"bind_id\":\"0x%llx\",\"flow_out\":true", (unsigned long long)ti.uid);
+            line_ += buffer;
+        }
+        else if (ti.groupUID != oqpi::invalid_task_uid)
+        {
+            snprintf(buffer, sizeof(buffer), ",\"bind_id\":\"0x%llx\",\"flow_in\":true", (unsigned long long)ti.groupUID);
+            line_ += buffer;
+        }
+        line_ += "}";
+
+        os_.write(line_.data(), std::streamsize(line_.size()));
+    }
+
+    // Instant event on the thief's thread
+    void writeSteal(const steal_info &si)
+    {
+        const auto stolenNs = ticks_to_nanoseconds(si.stolenAt, ticksPerSecond_);
+
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer),
+            "%s{\"name\":\"steal\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%u,\"tid\":%llu,\"ts\":%llu.%03u"
+            ",\"args\":{\"core\":%u,\"victim\":%llu}}",
+            eventCount_++ > 0 ? ",\n" : "\n",
+            processId_, (unsigned long long)si.thief,
+            (unsigned long long)(stolenNs / 1000), unsigned(stolenNs % 1000),
+            unsigned(si.thiefCore), (unsigned long long)si.victim);
+        os_ << buffer;
+    }
+
+    static std::string escape(const char *str, size_t length)
+    {
+        std::string escaped;
+        escaped.reserve(length);
+        for (size_t i = 0; i < length; ++i)
+        {
+            const auto c = str[i];
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if ((unsigned char)c < 0x20)
+            {
+                char buffer[8];
+                snprintf(buffer, sizeof(buffer), "\\u%04x", unsigned(c));
+                escaped += buffer;
+            }
+            else
+            {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+private:
+    std::ostream                        &os_;
+    const uint32_t                      processId_;
+    uint64_t                            eventCount_;
+    bool                                finished_;
+    std::vector<std::string>            names_;     // Already escaped
+    std::unordered_set<oqpi::task_uid>  openGroups_;
+    std::string                         line_;
+    frame_decoder                       decoder_;
+    // Nanoseconds until the client tells us otherwise
+    uint64_t                            ticksPerSecond_ = 1000000000ull;
+};
@@ -2,6 +2,12 @@
 
 #include <mutex>
 #include <queue>
+#include <atomic>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <type_traits>
 
 template <typename T, typename _Mutex>
 class qqueue
@@ -46,3 +52,175 @@ private:
     std::queue<T>   queue_;
     _Mutex          mutex_;
 };
+
+
+// Lock free bounded multiple producers, multiple consumers queue (Dmitry Vyukov's).
+//
+// Each cell carries a sequence number telling whether it is ready to be written or read for the
+// current lap: producers and consumers claim a cell with a CAS on their cursor then publish it
+// with a release store of its sequence. Nobody waits on anybody, except a consumer on the producer
+// of the very cell it claimed.
+//
+// push() can't fail: when all _Capacity cells are taken, elements go to a mutex protected overflow
+// queue until it is drained, which try_pop() only does once the cells are empty. Elements are
+// thus still popped roughly in order while the queue overflows.
+template <typename T, size_t _Capacity = 4096>
+class mpmc_queue
+{
+    static_assert(_Capacity >= 2 && (_Capacity & (_Capacity - 1)) == 0, "capacity must be a power of two");
+
+    static constexpr size_t cache_line_size = 64;
+
+public:
+    mpmc_queue()
+        : enqueuePos_(0)
+        , dequeuePos_(0)
+        , overflowCount_(0)
+    {
+        for (size_t i = 0; i < _Capacity; ++i)
+        {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~mpmc_queue()
+    {
+        T t;
+        while (try_pop(t))
+        {}
+    }
+
+    mpmc_queue(const mpmc_queue &) = delete;
+    mpmc_queue& operator=(const mpmc_queue &) = delete;
+
+    void push(T &&t)
+    {
+        emplace(std::move(t));
+    }
+
+    void push(const T &t)
+    {
+        emplace(t);
+    }
+
+    bool try_pop(T &v)
+    {
+        auto pos = dequeuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto &c = cells_[pos & mask];
+            const auto seq = c.sequence.load(std::memory_order_acquire);
+            const auto diff = intptr_t(seq) - intptr_t(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    auto &element = c.element();
+                    v = std::move(element);
+                    element.~T();
+                    c.sequence.store(pos + _Capacity, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                // Empty
+                return overflowCount_.load(std::memory_order_acquire) > 0 && popOverflow(v);
+            }
+            else
+            {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Only a hint when other threads push or pop concurrently
+    bool empty() const
+    {
+        return enqueuePos_.load(std::memory_order_relaxed) == dequeuePos_.load(std::memory_order_relaxed)
+            && overflowCount_.load(std::memory_order_relaxed) == 0;
+    }
+
+private:
+    static constexpr size_t mask = _Capacity - 1;
+
+    struct cell
+    {
+        std::atomic<size_t>                                             sequence;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type     storage;
+
+        T& element()
+        {
+            return *reinterpret_cast<T*>(&storage);
+        }
+    };
+
+    template<typename U>
+    void emplace(U &&u)
+    {
+        if (overflowCount_.load(std::memory_order_relaxed) > 0)
+        {
+            pushOverflow(std::forward<U>(u));
+            return;
+        }
+
+        auto pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto &c = cells_[pos & mask];
+            const auto seq = c.sequence.load(std::memory_order_acquire);
+            const auto diff = intptr_t(seq) - intptr_t(pos);
+            if (diff == 0)
+            {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    new (&c.storage) T(std::forward<U>(u));
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return;
+                }
+            }
+            else if (diff < 0)
+            {
+                // Full
+                pushOverflow(std::forward<U>(u));
+                return;
+            }
+            else
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    template<typename U>
+    void pushOverflow(U &&u)
+    {
+        std::lock_guard<std::mutex> lock(overflowMutex_);
+        overflow_.emplace(std::forward<U>(u));
+        overflowCount_.fetch_add(1, std::memory_order_release);
+    }
+
+    bool popOverflow(T &v)
+    {
+        std::lock_guard<std::mutex> lock(overflowMutex_);
+        if (overflow_.empty())
+        {
+            return false;
+        }
+        v = std::move(overflow_.front());
+        overflow_.pop();
+        overflowCount_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    cell                    cells_[_Capacity];
+    uint8_t                 padding0_[cache_line_size];
+    std::atomic<size_t>     enqueuePos_;
+    uint8_t                 padding1_[cache_line_size - sizeof(size_t)];
+    std::atomic<size_t>     dequeuePos_;
+    uint8_t                 padding2_[cache_line_size - sizeof(size_t)];
+    std::atomic<size_t>     overflowCount_;
+    std::mutex              overflowMutex_;
+    std::queue<T>           overflow_;
+};
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include "telemetry_protocol.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Append-only columnar storage of the completed tasks of a session.
+// Events are stored in fixed-size chunks, one array per field, so that scans only touch the columns
+// they need. Every event gets a sequence number, monotonically increasing over the life of the store.
+// Memory is bounded: once a chunk is full, the oldest chunks are evicted as a whole when they fall
+// out of the retention window or when the store exceeds its byte budget.
+class event_store
+{
+public:
+    static constexpr uint32_t chunk_capacity = 4096;
+
+    struct config
+    {
+        // Chunks whose events all stopped that long before the last recorded one are evicted
+        uint64_t    retentionWindowNs   = 3600ull * 1000000000ull;
+        // Upper bound of the memory used by the chunks
+        size_t      byteBudget          = 256 * 1024 * 1024;
+    };
+
+    // Timestamps are in nanoseconds of the client's clock
+    struct chunk
+    {
+        uint64_t                    firstSequence   = 0;
+        uint32_t                    count           = 0;
+        uint64_t                    minStart        = UINT64_MAX;
+        uint64_t                    maxStop         = 0;
+
+        oqpi::task_uid              uid[chunk_capacity];
+        oqpi::task_uid              parentUID[chunk_capacity];
+        uint64_t                    startedAt[chunk_capacity];
+        uint64_t                    stoppedAt[chunk_capacity];
+        task_info::thread_id        thread[chunk_capacity];
+        uint32_t                    nameId[chunk_capacity];
+        uint8_t                     core[chunk_capacity];
+
+        bool full() const { return count == chunk_capacity; }
+    };
+
+    // Copy of a single event, for random access
+    struct event
+    {
+        uint64_t                sequence;
+        oqpi::task_uid          uid;
+        oqpi::task_uid          parentUID;
+        uint64_t                startedAt;
+        uint64_t                stoppedAt;
+        task_info::thread_id    thread;
+        uint32_t                nameId;
+        uint8_t                 core;
+    };
+
+public:
+    event_store()
+        : event_store(config())
+    {}
+
+    explicit event_store(const config &cfg)
+        : config_(cfg)
+        , nextSequence_(0)
+        , lastStop_(0)
+    {}
+
+    // Appends an event with timestamps already converted to nanoseconds, returns its sequence number.
+    // onEvicted(const chunk&) is called for each chunk evicted to make room.
+    template<typename _OnEvicted>
+    uint64_t append(const task_info &ti, uint64_t startedAtNs, uint64_t stoppedAtNs, _OnEvicted &&onEvicted)
+    {
+        if (chunks_.empty() || chunks_.back()->full())
+        {
+            evict(onEvicted);
+            chunks_.emplace_back(new chunk);
+            chunks_.back()->firstSequence = nextSequence_;
+        }
+
+        auto &c = *chunks_.back();
+        const auto i = c.count++;
+        c.uid[i]        = ti.uid;
+        c.parentUID[i]  = ti.groupUID;
+        c.startedAt[i]  = startedAtNs;
+        c.stoppedAt[i]  = stoppedAtNs;
+        c.thread[i]     = ti.startedOnThread;
+        c.nameId[i]     = ti.nameId;
+        c.core[i]       = ti.startedOnCore;
+        c.minStart      = std::min(c.minStart, startedAtNs);
+        c.maxStop       = std::max(c.maxStop, stoppedAtNs);
+
+        lastStop_ = std::max(lastStop_, stoppedAtNs);
+        return nextSequence_++;
+    }
+
+    // Sequence number of the oldest event still stored
+    uint64_t firstSequence() const
+    {
+        return chunks_.empty() ? nextSequence_ : chunks_.front()->firstSequence;
+    }
+
+    uint64_t endSequence() const
+    {
+        return nextSequence_;
+    }
+
+    bool contains(uint64_t sequence) const
+    {
+        return sequence >= firstSequence() && sequence < nextSequence_;
+    }
+
+    event at(uint64_t sequence) const
+    {
+        const auto relative = sequence - firstSequence();
+        const auto &c = *chunks_[size_t(relative / chunk_capacity)];
+        const auto i = uint32_t(relative % chunk_capacity);
+        return event{ sequence, c.uid[i], c.parentUID[i], c.startedAt[i], c.stoppedAt[i], c.thread[i], c.nameId[i], c.core[i] };
+    }
+
+    size_t chunkCount() const
+    {
+        return chunks_.size();
+    }
+
+    // Chunks are ordered by sequence number, only the last one can be partially filled
+    const chunk& chunkAt(size_t index) const
+    {
+        return *chunks_[index];
+    }
+
+    // Most recent stop time recorded
+    uint64_t lastStop() const
+    {
+        return lastStop_;
+    }
+
+    size_t byteSize() const
+    {
+        return chunks_.size() * sizeof(chunk);
+    }
+
+private:
+    // The chunk being filled is never evicted
+    template<typename _OnEvicted>
+    void evict(_OnEvicted &onEvicted)
+    {
+        while (!chunks_.empty())
+        {
+            const auto &oldest = *chunks_.front();
+            const auto overBudget = byteSize() + sizeof(chunk) > config_.byteBudget;
+            const auto expired = lastStop_ - oldest.maxStop > config_.retentionWindowNs;
+            if (!overBudget && !expired)
+            {
+                break;
+            }
+
+            onEvicted(oldest);
+            chunks_.pop_front();
+        }
+    }
+
+private:
+    const config                        config_;
+    std::deque<std::unique_ptr<chunk>>  chunks_;
+    uint64_t                            nextSequence_;
+    uint64_t                            lastStop_;
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include "task_columns.hpp"
+#include "telemetry_protocol.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Decodes the records of a whole frame, header included, for a visitor. Every read is checked
+// against the size of the frame first: a corrupted or hostile frame throws "malformed frame" before
+// anything past its end is read.
+//
+// The visitor is called with, depending on the opcode of the frame:
+//  - onClock(const clock_record &), once the frequency was checked to be valid
+//  - onName(uint32_t nameId, const char *name, uint16_t length), nameId below max_name_count
+//  - onGroup(const group_info &)
+//  - onTask(const task_info &), for both end_task and end_task_packed frames
+//  - onSteal(const steal_info &)
+//  - onDropped(const dropped_info &)
+// Other opcodes are not records the visitor can be given, they throw "unexpected opcode".
+//
+// An instance keeps the scratch memory of the packed tasks from a frame to the next.
+//--------------------------------------------------------------------------------------------------
+class frame_decoder
+{
+public:
+    template<typename _Visitor>
+    void decode(const uint8_t *data, size_t size, _Visitor &visitor)
+    {
+        frame_header header;
+        size_t offset = 0;
+        read(data, size, offset, header);
+        if (header.size != size)
+        {
+            malformed();
+        }
+
+        switch (header.op)
+        {
+        case opcode::clock_info:
+            readRecords<clock_record>(data, size, offset, header.recordCount, [&visitor](const clock_record &cr)
+            {
+                if (cr.ticksPerSecond == 0)
+                {
+                    throw std::runtime_error("invalid clock frequency");
+                }
+                visitor.onClock(cr);
+            });
+            break;
+
+        case opcode::register_task:
+            // Names are at least as long as their record
+            checkRecordCount(size, offset, header.recordCount, sizeof(name_record));
+            for (uint32_t i = 0; i < header.recordCount; ++i)
+            {
+                name_record nr;
+                read(data, size, offset, nr);
+                if (nr.nameId >= max_name_count)
+                {
+                    throw std::runtime_error("invalid name id");
+                }
+                require(size, offset, nr.length);
+                visitor.onName(nr.nameId, (const char*)data + offset, nr.length);
+                offset += nr.length;
+            }
+            break;
+
+        case opcode::add_to_group:
+            readRecords<group_info>(data, size, offset, header.recordCount, [&visitor](const group_info &gi)
+            {
+                visitor.onGroup(gi);
+            });
+            break;
+
+        case opcode::end_task:
+            readRecords<task_info>(data, size, offset, header.recordCount, [&visitor](const task_info &ti)
+            {
+                visitor.onTask(ti);
+            });
+            break;
+
+        case opcode::end_task_packed:
+            offset += taskCodec_.decode(data + offset, size - offset, header.recordCount, [&visitor](const task_info &ti)
+            {
+                visitor.onTask(ti);
+            });
+            break;
+
+        case opcode::steal_task:
+            readRecords<steal_info>(data, size, offset, header.recordCount, [&visitor](const steal_info &si)
+            {
+                visitor.onSteal(si);
+            });
+            break;
+
+        case opcode::dropped_records:
+            readRecords<dropped_info>(data, size, offset, header.recordCount, [&visitor](const dropped_info &di)
+            {
+                visitor.onDropped(di);
+            });
+            break;
+
+        default:
+            throw std::runtime_error("unexpected opcode");
+        }
+
+        if (offset != size)
+        {
+            malformed();
+        }
+    }
+
+private:
+    [[noreturn]] static void malformed()
+    {
+        throw std::runtime_error("malformed frame");
+    }
+
+    // At least byteCount bytes must be left past offset
+    static void require(size_t size, size_t offset, size_t byteCount)
+    {
+        if (offset > size || byteCount > size - offset)
+        {
+            malformed();
+        }
+    }
+
+    // Rejects up front a count of records that can't fit in what is left of the frame
+    static void checkRecordCount(size_t size, size_t offset, uint32_t recordCount, size_t minRecordSize)
+    {
+        require(size, offset, 0);
+        if (uint64_t(recordCount) * minRecordSize > size - offset)
+        {
+            malformed();
+        }
+    }
+
+    template<typename T>
+    static void read(const uint8_t *data, size_t size, size_t &offset, T &t)
+    {
+        require(size, offset, sizeof(T));
+        memcpy(&t, data + offset, sizeof(T));
+        offset += sizeof(T);
+    }
+
+    template<typename T, typename _OnRecord>
+    static void readRecords(const uint8_t *data, size_t size, size_t &offset, uint32_t recordCount, _OnRecord &&onRecord)
+    {
+        checkRecordCount(size, offset, recordCount, sizeof(T));
+        for (uint32_t i = 0; i < recordCount; ++i)
+        {
+            T t;
+            read(data, size, offset, t);
+            onRecord(t);
+        }
+    }
+
+private:
+    task_column_codec taskCodec_;
+};
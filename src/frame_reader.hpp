@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include "telemetry_protocol.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Splits a byte stream in frames without copying them.
+// Bytes are received directly at writePtr(), parse() then hands out every complete frame as a view
+// in the internal buffer. What is left of an incomplete frame is moved to the front of the buffer.
+// The buffer starts small so that idle streams stay cheap, and grows when a single frame doesn't fit
+// in it, or when a read filled it whole, up to max_read_size in that case.
+class frame_reader
+{
+    static constexpr size_t max_read_size = 1024 * 1024;
+
+public:
+    explicit frame_reader(size_t initialSize = 16 * 1024)
+        : buffer_(initialSize)
+        , begin_(0)
+        , end_(0)
+    {}
+
+    uint8_t* writePtr()
+    {
+        return buffer_.data() + end_;
+    }
+
+    size_t writableSize() const
+    {
+        return buffer_.size() - end_;
+    }
+
+    // Signals that size bytes have been written at writePtr()
+    void commit(size_t size)
+    {
+        end_ += size;
+    }
+
+    // Calls onFrame(data, size) for each complete frame, throws on a corrupted stream
+    template<typename _OnFrame>
+    void parse(_OnFrame &&onFrame)
+    {
+        const auto filled = writableSize() == 0;
+        while (end_ - begin_ >= sizeof(frame_header))
+        {
+            uint32_t frameSize = 0;
+            memcpy(&frameSize, buffer_.data() + begin_, sizeof(frameSize));
+            if (frameSize < sizeof(frame_header) || frameSize > max_frame_size)
+            {
+                throw std::runtime_error("invalid frame size " + std::to_string(frameSize));
+            }
+
+            if (end_ - begin_ < frameSize)
+            {
+                // Make sure the rest of this frame fits in the buffer
+                if (frameSize > buffer_.size())
+                {
+                    buffer_.resize(frameSize);
+                }
+                break;
+            }
+
+            onFrame(buffer_.data() + begin_, size_t(frameSize));
+            begin_ += frameSize;
+        }
+
+        compact();
+        if (filled && buffer_.size() < max_read_size)
+        {
+            buffer_.resize(buffer_.size() * 2);
+        }
+    }
+
+private:
+    void compact()
+    {
+        if (begin_ == end_)
+        {
+            begin_ = end_ = 0;
+        }
+        else if (begin_ > 0 && writableSize() < buffer_.size() / 2)
+        {
+            memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+    }
+
+private:
+    std::vector<uint8_t>    buffer_;
+    size_t                  begin_;
+    size_t                  end_;
+};
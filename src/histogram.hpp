@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <algorithm>
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+
+//--------------------------------------------------------------------------------------------------
+// Log-linear histogram of 64-bit values (HDR style).
+// Values below 2*sub_bucket_count are recorded exactly, above that each power of two is split in
+// sub_bucket_count buckets, giving a relative error of 1/sub_bucket_count. Values are clamped to
+// max_trackable_value. The memory footprint is fixed whatever the amount of recorded values.
+class histogram
+{
+public:
+    static constexpr uint32_t sub_bucket_bits       = 5;
+    static constexpr uint32_t sub_bucket_count      = 1u << sub_bucket_bits;
+    static constexpr uint32_t max_value_bits        = 40; // ~18 minutes when recording nanoseconds
+    static constexpr uint64_t max_trackable_value   = (1ull << max_value_bits) - 1;
+    static constexpr uint32_t bucket_count          = (max_value_bits - sub_bucket_bits + 1) * sub_bucket_count;
+
+public:
+    histogram()
+    {
+        reset();
+    }
+
+    void record(uint64_t value)
+    {
+        value = std::min(value, max_trackable_value);
+        ++counts_[bucketIndex(value)];
+        ++count_;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const histogram &other)
+    {
+        for (uint32_t i = 0; i < bucket_count; ++i)
+        {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    void reset()
+    {
+        counts_.fill(0);
+        count_  = 0;
+        min_    = UINT64_MAX;
+        max_    = 0;
+    }
+
+    uint64_t count() const  { return count_; }
+    uint64_t min() const    { return count_ ? min_ : 0; }
+    uint64_t max() const    { return max_; }
+
+    // Returns the smallest recorded value such that percentile% of the values are lower or equal to it,
+    // within the precision of the buckets.
+    uint64_t valueAtPercentile(double percentile) const
+    {
+        if (count_ == 0)
+        {
+            return 0;
+        }
+
+        const auto clamped = std::min(std::max(percentile, 0.0), 100.0);
+        const auto target = std::max<uint64_t>(1, uint64_t(clamped / 100.0 * double(count_) + 0.5));
+        uint64_t cumulated = 0;
+        for (uint32_t i = 0; i < bucket_count; ++i)
+        {
+            cumulated += counts_[i];
+            if (cumulated >= target)
+            {
+                return std::min(std::max(highestEquivalentValue(i), min_), max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    static uint32_t bucketIndex(uint64_t value)
+    {
+        if (value < 2 * sub_bucket_count)
+        {
+            return uint32_t(value);
+        }
+
+        const auto shift = mostSignificantBit(value) - sub_bucket_bits;
+        return (shift + 1) * sub_bucket_count + uint32_t(value >> shift) - sub_bucket_count;
+    }
+
+    static uint64_t highestEquivalentValue(uint32_t index)
+    {
+        if (index < 2 * sub_bucket_count)
+        {
+            return index;
+        }
+
+        const auto shift = index / sub_bucket_count - 1;
+        const auto top = uint64_t(index % sub_bucket_count + sub_bucket_count);
+        return ((top + 1) << shift) - 1;
+    }
+
+    static uint32_t mostSignificantBit(uint64_t value)
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long msb;
+        _BitScanReverse64(&msb, value);
+        return uint32_t(msb);
+#elif defined(_MSC_VER)
+        unsigned long msb;
+        if (_BitScanReverse(&msb, uint32_t(value >> 32)))
+        {
+            return uint32_t(msb) + 32;
+        }
+        _BitScanReverse(&msb, uint32_t(value));
+        return uint32_t(msb);
+#else
+        return uint32_t(63 - __builtin_clzll(value));
+#endif
+    }
+
+private:
+    std::array<uint64_t, bucket_count>  counts_;
+    uint64_t                            count_;
+    uint64_t                            min_;
+    uint64_t                            max_;
+};
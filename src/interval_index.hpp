@@ -0,0 +1,249 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+
+//--------------------------------------------------------------------------------------------------
+// Time interval index of the events of an event_store, maintained as they are appended.
+// Entries are kept in blocks sorted by start time, the blocks themselves being ordered. A max tree
+// over the latest stop time of each block finds the blocks that can overlap a range without
+// visiting the others, so a query costs O(log(blocks)) plus the size of the blocks it reports from.
+// Events arrive mostly in start order, inserting them is then an append to the last block.
+// Entries are pruned along with the store: whole blocks go away once all their events were evicted,
+// lingering entries are skipped by queries and dropped when their block is split.
+class interval_index
+{
+public:
+    static constexpr size_t block_capacity = 256;
+
+    struct entry
+    {
+        uint64_t startNs;
+        uint64_t stopNs;
+        uint64_t sequence; // In the event store
+    };
+
+public:
+    void insert(uint64_t startNs, uint64_t stopNs, uint64_t sequence)
+    {
+        // Zero length tasks are still found by stabbing queries at their start
+        const entry e{ startNs, std::max(stopNs, startNs + 1), sequence };
+
+        if (blocks_.empty())
+        {
+            blocks_.emplace_back(new block);
+        }
+
+        // Last block starting before the entry, the first one if none does
+        auto it = std::upper_bound(blocks_.begin() + 1, blocks_.end(), e.startNs, [](uint64_t startNs, const std::unique_ptr<block> &b)
+        {
+            return startNs < b->entries.front().startNs;
+        });
+        auto index = size_t(it - blocks_.begin()) - 1;
+
+        auto *pBlock = blocks_[index].get();
+        if (pBlock->entries.size() >= block_capacity)
+        {
+            if (index + 1 == blocks_.size() && e.startNs >= pBlock->entries.back().startNs)
+            {
+                // In order insertion, start a new block
+                blocks_.emplace_back(new block);
+                pBlock = blocks_[++index].get();
+            }
+            else if (split(index))
+            {
+                if (e.startNs >= blocks_[index + 1]->entries.front().startNs)
+                {
+                    ++index;
+                }
+                pBlock = blocks_[index].get();
+            }
+        }
+
+        auto &entries = pBlock->entries;
+        const auto pos = std::upper_bound(entries.begin(), entries.end(), e.startNs, [](uint64_t startNs, const entry &other)
+        {
+            return startNs < other.startNs;
+        });
+        entries.insert(pos, e);
+        pBlock->maxStop = std::max(pBlock->maxStop, e.stopNs);
+        pBlock->maxSequence = std::max(pBlock->maxSequence, e.sequence);
+        updateTree(index);
+        ++size_;
+    }
+
+    // Forgets the entries whose sequence is below firstSequence
+    void prune(uint64_t firstSequence)
+    {
+        if (firstSequence <= firstSequence_)
+        {
+            return;
+        }
+        firstSequence_ = firstSequence;
+
+        const auto end = std::remove_if(blocks_.begin(), blocks_.end(), [this](const std::unique_ptr<block> &b)
+        {
+            if (b->maxSequence >= firstSequence_)
+            {
+                return false;
+            }
+            size_ -= b->entries.size();
+            return true;
+        });
+        if (end != blocks_.end())
+        {
+            blocks_.erase(end, blocks_.end());
+            rebuildTree();
+        }
+    }
+
+    // Calls f(const entry&) for each entry overlapping [fromNs, toNs), by increasing start time.
+    // Stops early when f returns false.
+    template<typename _F>
+    void forEachOverlapping(uint64_t fromNs, uint64_t toNs, _F &&f) const
+    {
+        if (blocks_.empty() || fromNs >= toNs)
+        {
+            return;
+        }
+
+        // Blocks starting at or after toNs can't overlap
+        const auto end = std::lower_bound(blocks_.begin() + 1, blocks_.end(), toNs, [](const std::unique_ptr<block> &b, uint64_t ns)
+        {
+            return b->entries.front().startNs < ns;
+        });
+        visit(1, 0, leafCount_, size_t(end - blocks_.begin()), fromNs, toNs, f);
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    struct block
+    {
+        std::vector<entry>  entries;        // Sorted by start time
+        uint64_t            maxStop     = 0;
+        uint64_t            maxSequence = 0;
+    };
+
+private:
+    // Returns false when the node's subtree was cut short by f
+    template<typename _F>
+    bool visit(size_t node, size_t lo, size_t hi, size_t endBlock, uint64_t fromNs, uint64_t toNs, _F &f) const
+    {
+        if (lo >= endBlock || tree_[node] <= fromNs)
+        {
+            return true;
+        }
+
+        if (hi - lo == 1)
+        {
+            for (const auto &e : blocks_[lo]->entries)
+            {
+                if (e.startNs >= toNs)
+                {
+                    break;
+                }
+                if (e.stopNs > fromNs && e.sequence >= firstSequence_ && !f(e))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        const auto mid = (lo + hi) / 2;
+        return visit(2 * node, lo, mid, endBlock, fromNs, toNs, f)
+            && visit(2 * node + 1, mid, hi, endBlock, fromNs, toNs, f);
+    }
+
+    // Moves the upper half of a full block to a new one, returns false if dropping the pruned
+    // entries was enough to make room. That never empties the block, prune() would have removed it.
+    bool split(size_t index)
+    {
+        auto &entries = blocks_[index]->entries;
+        const auto end = std::remove_if(entries.begin(), entries.end(), [this](const entry &e)
+        {
+            return e.sequence < firstSequence_;
+        });
+        if (end != entries.end())
+        {
+            size_ -= size_t(entries.end() - end);
+            entries.erase(end, entries.end());
+            summarize(*blocks_[index]);
+            updateTree(index);
+            return false;
+        }
+
+        std::unique_ptr<block> spUpper(new block);
+        const auto half = entries.begin() + entries.size() / 2;
+        spUpper->entries.assign(half, entries.end());
+        entries.erase(half, entries.end());
+        summarize(*blocks_[index]);
+        summarize(*spUpper);
+        blocks_.insert(blocks_.begin() + index + 1, std::move(spUpper));
+        rebuildTree();
+        return true;
+    }
+
+    static void summarize(block &b)
+    {
+        b.maxStop = 0;
+        b.maxSequence = 0;
+        for (const auto &e : b.entries)
+        {
+            b.maxStop = std::max(b.maxStop, e.stopNs);
+            b.maxSequence = std::max(b.maxSequence, e.sequence);
+        }
+    }
+
+    void updateTree(size_t index)
+    {
+        if (index >= leafCount_)
+        {
+            rebuildTree();
+            return;
+        }
+
+        auto node = leafCount_ + index;
+        tree_[node] = blocks_[index]->maxStop;
+        for (node /= 2; node > 0; node /= 2)
+        {
+            tree_[node] = std::max(tree_[2 * node], tree_[2 * node + 1]);
+        }
+    }
+
+    void rebuildTree()
+    {
+        // Leaves are allocated ahead so that appending blocks seldom needs a rebuild
+        leafCount_ = 1;
+        while (leafCount_ < blocks_.size())
+        {
+            leafCount_ *= 2;
+        }
+        leafCount_ *= 2;
+
+        tree_.assign(2 * leafCount_, 0);
+        for (size_t i = 0; i < blocks_.size(); ++i)
+        {
+            tree_[leafCount_ + i] = blocks_[i]->maxStop;
+        }
+        for (auto node = leafCount_ - 1; node > 0; --node)
+        {
+            tree_[node] = std::max(tree_[2 * node], tree_[2 * node + 1]);
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<block>> blocks_;
+    // Max stop time per subtree of blocks, leaves start at leafCount_
+    std::vector<uint64_t>               tree_;
+    size_t                              leafCount_      = 0;
+    size_t                              size_           = 0;
+    uint64_t                            firstSequence_  = 0;
+};
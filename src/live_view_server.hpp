@@ -0,0 +1,362 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <sstream>
+
+#define ASIO_STANDALONE
+#define _WEBSOCKETPP_CPP11_STL_
+#include "websocketpp/config/asio_no_tls.hpp"
+#include "websocketpp/server.hpp"
+
+#include "visualizer_server.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Streams the timeline of a session to browsers (see oqpi_visualizer.html).
+//
+// Raw events are never forwarded: each viewer tells which range it looks at and how many pixels it
+// has, and periodically receives one bucket per pixel and per lane.
+//
+// Viewer -> server, text commands:
+//  - follow <spanNs> <buckets> [core|thread] [sessionId]   the last spanNs of the session, live
+//  - view <fromNs> <toNs> <buckets> [core|thread] [sessionId]
+//  - tasks <fromNs> <toNs> [sessionId]                       the tasks that ran during the range
+//  A sessionId of 0 (default) designates the most recent session.
+//
+// Server -> viewer, binary little-endian messages starting with a uint32 message type:
+//  - names:    sessionId u32, firstNameId u32, count u32, then count * (length u16, characters)
+//  - timeline: sessionId u32, laneCount u32, bucketCount u32, kind u8, padding[3], fromNs f64,
+//              bucketNs f64, then per lane: key u64 followed by bucketCount * live_view_bucket
+//  - tasks:    sessionId u32, count u32, then count * live_view_task, by increasing start time
+//--------------------------------------------------------------------------------------------------
+class live_view_server
+{
+public:
+    using ws_server = websocketpp::server<websocketpp::config::asio>;
+
+    enum message_type : uint32_t
+    {
+        names_message = 1,
+        timeline_message = 2,
+        tasks_message = 3,
+    };
+
+#pragma pack(push, 1)
+    struct live_view_bucket
+    {
+        uint8_t     occupancy;  // Busy time over bucket duration, 255 being fully busy
+        uint8_t     padding;
+        uint16_t    taskCount;  // Tasks started in the bucket, saturated
+        uint32_t    nameId;     // Dominant name
+    };
+
+    struct live_view_task
+    {
+        uint64_t    uid;
+        uint64_t    groupUID;
+        uint64_t    startedAtNs;
+        uint64_t    stoppedAtNs;
+        uint64_t    thread;
+        uint32_t    nameId;
+        uint8_t     core;
+        uint8_t     padding[3];
+    };
+#pragma pack(pop)
+
+    struct config
+    {
+        uint16_t                    port            = 9002;
+        std::chrono::milliseconds   refreshPeriod   = std::chrono::milliseconds(50);
+        // Updates are skipped for viewers that don't keep up
+        size_t                      maxBufferedBytes = 4 * 1024 * 1024;
+        uint32_t                    maxBuckets      = 8192;
+        size_t                      maxTasks        = 256;
+    };
+
+public:
+    live_view_server(asio::io_service &ioService, visualizer_server &server)
+        : live_view_server(ioService, server, config())
+    {}
+
+    live_view_server(asio::io_service &ioService, visualizer_server &server, const config &cfg)
+        : config_(cfg)
+        , server_(server)
+        , timer_(ioService)
+    {
+        ws_.clear_access_channels(websocketpp::log::alevel::all);
+        ws_.init_asio(&ioService);
+        ws_.set_reuse_addr(true);
+
+        ws_.set_open_handler([this](websocketpp::connection_hdl hdl)
+        {
+            std::lock_guard<std::mutex> __l(viewersMutex_);
+            viewers_[hdl] = viewer();
+        });
+
+        ws_.set_close_handler([this](websocketpp::connection_hdl hdl)
+        {
+            std::lock_guard<std::mutex> __l(viewersMutex_);
+            viewers_.erase(hdl);
+        });
+
+        ws_.set_message_handler([this](websocketpp::connection_hdl hdl, ws_server::message_ptr spMsg)
+        {
+            onCommand(hdl, spMsg->get_payload());
+        });
+
+        ws_.listen(config_.port);
+        ws_.start_accept();
+        scheduleRefresh();
+    }
+
+    void stop()
+    {
+        asio::error_code timerError;
+        timer_.cancel(timerError);
+
+        websocketpp::lib::error_code error;
+        ws_.stop_listening(error);
+
+        std::lock_guard<std::mutex> __l(viewersMutex_);
+        for (auto &entry : viewers_)
+        {
+            ws_.close(entry.first, websocketpp::close::status::going_away, "server shutting down", error);
+        }
+    }
+
+private:
+    struct viewer
+    {
+        bool        follow          = true;
+        uint64_t    spanNs          = 1000000000ull;
+        uint64_t    fromNs          = 0;
+        uint64_t    toNs            = 0;
+        uint32_t    buckets         = 0;
+        lane_kind   kind            = lane_kind::core;
+        uint32_t    sessionId       = 0;
+        // Names already sent, for the session they were sent for
+        uint32_t    namesSessionId  = 0;
+        uint32_t    namesSent       = 0;
+    };
+
+private:
+    void onCommand(websocketpp::connection_hdl hdl, const std::string &command)
+    {
+        std::istringstream iss(command);
+        std::string verb, kind;
+        viewer v;
+        if (iss >> verb && verb == "tasks")
+        {
+            uint64_t fromNs = 0, toNs = 0;
+            uint32_t sessionId = 0;
+            if (iss >> fromNs >> toNs)
+            {
+                iss >> sessionId;
+                sendTasks(hdl, sessionId, fromNs, toNs);
+            }
+            return;
+        }
+        else if (verb == "follow")
+        {
+            v.follow = true;
+            iss >> v.spanNs >> v.buckets;
+        }
+        else if (verb == "view")
+        {
+            v.follow = false;
+            iss >> v.fromNs >> v.toNs >> v.buckets;
+        }
+        else
+        {
+            return;
+        }
+        if (iss.fail() || v.buckets == 0)
+        {
+            return;
+        }
+        if (iss >> kind)
+        {
+            v.kind = (kind == "thread") ? lane_kind::thread : lane_kind::core;
+            iss >> v.sessionId;
+        }
+        v.buckets = std::min(v.buckets, config_.maxBuckets);
+
+        std::lock_guard<std::mutex> __l(viewersMutex_);
+        auto it = viewers_.find(hdl);
+        if (it != viewers_.end())
+        {
+            // Keep track of the names already sent
+            v.namesSessionId = it->second.namesSessionId;
+            v.namesSent = it->second.namesSent;
+            it->second = v;
+        }
+    }
+
+    void scheduleRefresh()
+    {
+        timer_.expires_from_now(config_.refreshPeriod);
+        timer_.async_wait([this](const asio::error_code &error)
+        {
+            if (error)
+            {
+                return;
+            }
+
+            refresh();
+            scheduleRefresh();
+        });
+    }
+
+    void refresh()
+    {
+        std::lock_guard<std::mutex> __l(viewersMutex_);
+        for (auto &entry : viewers_)
+        {
+            auto &v = entry.second;
+            if (v.buckets == 0)
+            {
+                continue;
+            }
+
+            websocketpp::lib::error_code error;
+            auto spConnection = ws_.get_con_from_hdl(entry.first, error);
+            if (error || spConnection->get_buffered_amount() > config_.maxBufferedBytes)
+            {
+                continue;
+            }
+
+            const auto spSession = server_.findSession(v.sessionId);
+            if (!spSession)
+            {
+                continue;
+            }
+
+            const auto &t = spSession->getTelemetry();
+            if (v.namesSessionId != spSession->id())
+            {
+                v.namesSessionId = spSession->id();
+                v.namesSent = 0;
+            }
+            sendNames(entry.first, spSession->id(), v, t.namesFrom(v.namesSent));
+
+            auto toNs = v.toNs;
+            auto fromNs = v.fromNs;
+            if (v.follow)
+            {
+                toNs = t.lastTimestamp();
+                fromNs = toNs > v.spanNs ? toNs - v.spanNs : 0;
+            }
+            sendTimeline(entry.first, spSession->id(), t.queryTimeline(fromNs, toNs, v.buckets, v.kind));
+        }
+    }
+
+    void sendTasks(websocketpp::connection_hdl hdl, uint32_t sessionId, uint64_t fromNs, uint64_t toNs)
+    {
+        const auto spSession = server_.findSession(sessionId);
+        if (!spSession)
+        {
+            return;
+        }
+
+        const auto events = spSession->getTelemetry().tasksOverlapping(fromNs, toNs, config_.maxTasks);
+        std::vector<uint8_t> message;
+        append(message, uint32_t(tasks_message));
+        append(message, spSession->id());
+        append(message, uint32_t(events.size()));
+        for (const auto &e : events)
+        {
+            live_view_task lvt;
+            lvt.uid         = e.uid;
+            lvt.groupUID    = e.parentUID;
+            lvt.startedAtNs = e.startedAt;
+            lvt.stoppedAtNs = e.stoppedAt;
+            lvt.thread      = uint64_t(e.thread);
+            lvt.nameId      = e.nameId;
+            lvt.core        = e.core;
+            memset(lvt.padding, 0, sizeof(lvt.padding));
+            append(message, lvt);
+        }
+
+        websocketpp::lib::error_code error;
+        ws_.send(hdl, message.data(), message.size(), websocketpp::frame::opcode::binary, error);
+    }
+
+    void sendNames(websocketpp::connection_hdl hdl, uint32_t sessionId, viewer &v, const std::vector<std::string> &names)
+    {
+        if (names.empty())
+        {
+            return;
+        }
+
+        message_.clear();
+        append(message_, uint32_t(names_message));
+        append(message_, sessionId);
+        append(message_, v.namesSent);
+        append(message_, uint32_t(names.size()));
+        for (const auto &name : names)
+        {
+            const auto length = uint16_t(std::min<size_t>(name.size(), UINT16_MAX));
+            append(message_, length);
+            message_.insert(message_.end(), name.begin(), name.begin() + length);
+        }
+
+        websocketpp::lib::error_code error;
+        ws_.send(hdl, message_.data(), message_.size(), websocketpp::frame::opcode::binary, error);
+        if (!error)
+        {
+            v.namesSent += uint32_t(names.size());
+        }
+    }
+
+    void sendTimeline(websocketpp::connection_hdl hdl, uint32_t sessionId, const timeline &tl)
+    {
+        message_.clear();
+        append(message_, uint32_t(timeline_message));
+        append(message_, sessionId);
+        append(message_, uint32_t(tl.lanes.size()));
+        append(message_, tl.bucketCount);
+        append(message_, uint8_t(tl.kind));
+        append(message_, uint8_t(0));
+        append(message_, uint16_t(0));
+        append(message_, double(tl.fromNs));
+        append(message_, double(tl.bucketNs));
+
+        for (const auto &lane : tl.lanes)
+        {
+            append(message_, lane.key);
+            for (const auto &b : lane.buckets)
+            {
+                live_view_bucket lvb;
+                lvb.occupancy   = uint8_t(std::min<uint64_t>(255, b.busyNs * 255 / tl.bucketNs));
+                lvb.padding     = 0;
+                lvb.taskCount   = uint16_t(std::min<uint32_t>(b.taskCount, UINT16_MAX));
+                lvb.nameId      = b.nameId;
+                append(message_, lvb);
+            }
+        }
+
+        websocketpp::lib::error_code error;
+        ws_.send(hdl, message_.data(), message_.size(), websocketpp::frame::opcode::binary, error);
+    }
+
+    template<typename T>
+    static void append(std::vector<uint8_t> &message, const T &t)
+    {
+        const auto offset = message.size();
+        message.resize(offset + sizeof(T));
+        memcpy(message.data() + offset, &t, sizeof(T));
+    }
+
+private:
+    const config                        config_;
+    visualizer_server                   &server_;
+    ws_server                           ws_;
+    asio::steady_timer                  timer_;
+    std::mutex                          viewersMutex_;
+    std::map<websocketpp::connection_hdl, viewer, std::owner_less<websocketpp::connection_hdl>> viewers_;
+    // Only used by refresh(), under the lock
+    std::vector<uint8_t>                message_;
+};
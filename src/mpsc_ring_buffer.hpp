@@ -0,0 +1,256 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "buffer_interface.hpp"
+
+
+// We use buffer_interface to provide some helpful generic accessors
+using mpsc_ring_buffer = buffer_interface<class mpsc_ring_buffer_impl>;
+
+// Thread safe single consumer, multiple producers, non overwriting ring buffer.
+//
+// Each write() is a record: producers claim its space with a single fetch-add of the write cursor,
+// copy it, then publish its size in its 8 byte header with a release store. A zero size means
+// "not committed yet": the consumer stops there, so it never sees a half written record, and
+// records committed out of order are read in claim order.
+// The consumer zeroes the records it is done with before releasing their space, which is what
+// makes a zero header reliable on the next lap.
+//
+// For the consumer, the records form a stream of bytes, exactly like ring_buffer: it can read a
+// record piecewise, as long as producers write the pieces together in a single write().
+//
+// Producers check for room before claiming. Two producers racing for the last bytes can still
+// over-claim: the loser then waits for the consumer to release enough space.
+class mpsc_ring_buffer_impl
+{
+    static constexpr size_t     cache_line_size = 64;
+    static constexpr uint32_t   header_size     = 8;
+    static constexpr uint32_t   alignment       = 8;
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "record headers are accessed in place");
+    static_assert(ATOMIC_INT_LOCK_FREE == 2, "record headers are accessed in place");
+
+    static void default_array_delete(uint8_t* ptr)
+    {
+        std::default_delete<uint8_t[]> defaultDeleter;
+        defaultDeleter(ptr);
+    }
+
+    // Rounds up to a power of two, at least a cache line
+    static uint32_t capacityFor(int32_t bufferSize)
+    {
+        assert(bufferSize > 0);
+        uint32_t capacity = cache_line_size;
+        while (capacity < uint32_t(bufferSize))
+        {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    // Rounds down to a power of two
+    static uint32_t largestCapacityIn(int32_t bufferSize)
+    {
+        assert(bufferSize >= int32_t(cache_line_size));
+        uint32_t capacity = cache_line_size;
+        while (capacity * 2 <= uint32_t(bufferSize))
+        {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    static uint32_t recordSizeFor(uint32_t size)
+    {
+        return (header_size + size + alignment - 1) & ~(alignment - 1);
+    }
+
+protected:
+    // The capacity is bufferSize rounded up to a power of two
+    mpsc_ring_buffer_impl(int32_t bufferSize)
+        : buffer_(new uint8_t[capacityFor(bufferSize)](), &mpsc_ring_buffer_impl::default_array_delete)
+        , capacity_(capacityFor(bufferSize))
+        , mask_(capacity_ - 1)
+        , writeCursor_(0)
+        , readCursor_(0)
+        , readOffset_(0)
+    {}
+
+    // The buffer must be 8 bytes aligned, the largest power of two fitting in bufferSize is used
+    template<typename _Deleter>
+    mpsc_ring_buffer_impl(uint8_t* pBufferInit, int32_t bufferSize, _Deleter deleter)
+        : buffer_(pBufferInit, deleter)
+        , capacity_(largestCapacityIn(bufferSize))
+        , mask_(capacity_ - 1)
+        , writeCursor_(0)
+        , readCursor_(0)
+        , readOffset_(0)
+    {
+        assert((reinterpret_cast<uintptr_t>(pBufferInit) & (alignment - 1)) == 0);
+        memset(pBufferInit, 0, capacity_);
+    }
+
+protected:
+    //----------------------------------------------------------------------------------------------
+    // Producer side, any thread
+
+    bool write(const uint8_t *src, int32_t size)
+    {
+        assert(src != nullptr);
+        assert(size > 0);
+
+        const auto recordSize = recordSizeFor(uint32_t(size));
+        // Read cursor first: it can't be ahead of a write cursor loaded afterwards
+        const auto r = readCursor_.load(std::memory_order_acquire);
+        const auto used = writeCursor_.load(std::memory_order_relaxed) - r;
+        if (used > capacity_ || recordSize > capacity_ - used)
+        {
+            return false;
+        }
+
+        const auto w = writeCursor_.fetch_add(recordSize, std::memory_order_relaxed);
+        while (w + recordSize - readCursor_.load(std::memory_order_acquire) > capacity_)
+        {
+            std::this_thread::yield();
+        }
+
+        copyIn(w + header_size, src, uint32_t(size));
+        header(w).store(uint32_t(size), std::memory_order_release);
+        return true;
+    }
+
+    //----------------------------------------------------------------------------------------------
+    // Consumer side
+
+    bool read(uint8_t *dst, int32_t size)
+    {
+        assert(dst != nullptr);
+        assert(size > 0);
+
+        if (!isReadable(uint32_t(size)))
+        {
+            return false;
+        }
+
+        auto remaining = uint32_t(size);
+        while (remaining > 0)
+        {
+            const auto r = readCursor_.load(std::memory_order_relaxed);
+            const auto recordPayloadSize = header(r).load(std::memory_order_relaxed);
+            const auto sliceSize = std::min(remaining, recordPayloadSize - readOffset_);
+            copyOut(dst, r + header_size + readOffset_, sliceSize);
+            dst += sliceSize;
+            remaining -= sliceSize;
+            readOffset_ += sliceSize;
+
+            if (readOffset_ == recordPayloadSize)
+            {
+                release(r, recordSizeFor(recordPayloadSize));
+                readOffset_ = 0;
+            }
+        }
+        return true;
+    }
+
+protected:
+    // Committed bytes not read yet, only meaningful from the consumer
+    int32_t readableSize() const
+    {
+        auto r = readCursor_.load(std::memory_order_relaxed);
+        const auto end = r + capacity_;
+        uint32_t readable = 0;
+        while (r != end)
+        {
+            const auto recordPayloadSize = header(r).load(std::memory_order_acquire);
+            if (recordPayloadSize == 0)
+            {
+                break;
+            }
+            readable += recordPayloadSize;
+            r += recordSizeFor(recordPayloadSize);
+        }
+        return int32_t(readable - readOffset_);
+    }
+
+    // Largest record that can be written right now, a lower bound from any thread
+    int32_t writableSize() const
+    {
+        const auto r = readCursor_.load(std::memory_order_acquire);
+        const auto used = writeCursor_.load(std::memory_order_relaxed) - r;
+        return used + header_size < capacity_ ? int32_t(capacity_ - used - header_size) : 0;
+    }
+
+private:
+    // Whether size bytes are committed past the read position. Stops walking the headers as soon as
+    // they are: reading a record costs its own headers, not those of the whole buffer.
+    bool isReadable(uint32_t size) const
+    {
+        auto r = readCursor_.load(std::memory_order_relaxed);
+        const auto end = r + capacity_;
+        uint32_t readable = 0;
+        while (r != end && readable < size + readOffset_)
+        {
+            const auto recordPayloadSize = header(r).load(std::memory_order_acquire);
+            if (recordPayloadSize == 0)
+            {
+                break;
+            }
+            readable += recordPayloadSize;
+            r += recordSizeFor(recordPayloadSize);
+        }
+        return readable >= size + readOffset_;
+    }
+
+    std::atomic<uint32_t>& header(uint32_t cursor) const
+    {
+        return *reinterpret_cast<std::atomic<uint32_t>*>(buffer_.get() + (cursor & mask_));
+    }
+
+    void copyIn(uint32_t cursor, const uint8_t *src, uint32_t size)
+    {
+        const auto start = cursor & mask_;
+        const auto firstSliceSize = std::min(size, capacity_ - start);
+        memcpy(buffer_.get() + start, src, firstSliceSize);
+        memcpy(buffer_.get(), src + firstSliceSize, size - firstSliceSize);
+    }
+
+    void copyOut(uint8_t *dst, uint32_t cursor, uint32_t size) const
+    {
+        const auto start = cursor & mask_;
+        const auto firstSliceSize = std::min(size, capacity_ - start);
+        memcpy(dst, buffer_.get() + start, firstSliceSize);
+        memcpy(dst + firstSliceSize, buffer_.get(), size - firstSliceSize);
+    }
+
+    // Zeroes a record and hands its space back to the producers
+    void release(uint32_t cursor, uint32_t recordSize)
+    {
+        const auto start = cursor & mask_;
+        const auto firstSliceSize = std::min(recordSize, capacity_ - start);
+        memset(buffer_.get() + start, 0, firstSliceSize);
+        memset(buffer_.get(), 0, recordSize - firstSliceSize);
+        readCursor_.store(cursor + recordSize, std::memory_order_release);
+    }
+
+private:
+    // Read only after construction
+    std::unique_ptr<uint8_t[], void(*)(uint8_t*)>   buffer_;
+    const uint32_t                                  capacity_;
+    const uint32_t                                  mask_;
+    uint8_t                                         padding0_[cache_line_size];
+
+    // Claimed by the producers
+    std::atomic<uint32_t>                           writeCursor_;
+    uint8_t                                         padding1_[cache_line_size - sizeof(uint32_t)];
+
+    // Written by the consumer
+    std::atomic<uint32_t>                           readCursor_;
+    uint32_t                                        readOffset_;    // In the payload of the record at readCursor_
+    uint8_t                                         padding2_[cache_line_size - sizeof(uint32_t) * 2];
+};
@@ -0,0 +1,1266 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <type_traits>
+#include <new>
+#include <cstdlib>
+
+#include "oqpi.hpp"
+
+#include "cqueue.hpp"
+#include "frame_decoder.hpp"
+#include "mpsc_ring_buffer.hpp"
+#include "shared_memory_ring.hpp"
+#include "task_columns.hpp"
+#include "timer_contexts.hpp"
+#include "work_stealing_queue.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Benchmarks and stress tests of the building blocks of the instrumentation.
+//
+// Usage: oqpi_benchmarks [suite...]
+// Runs all the suites when none is given. The process returns a non zero code if any check failed.
+//
+// Besides the Visual Studio project, it builds on Linux with:
+//  g++ -std=c++14 -O2 -pthread -Iexternal/oqpi/include -Iexternal/asio/asio/include
+//      src/oqpi_benchmarks.cpp -o oqpi_benchmarks
+//--------------------------------------------------------------------------------------------------
+using clock_type = std::chrono::steady_clock;
+
+// Heap allocations made by the calling thread, counted by the replacement of operator new below
+uint64_t& thread_allocation_count()
+{
+    static thread_local uint64_t count = 0;
+    return count;
+}
+
+void* operator new(std::size_t size)
+{
+    ++thread_allocation_count();
+    if (auto p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+// Not inlined in the callers: GCC would see free() on the result of a new expression and warn
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void deallocate(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    deallocate(p);
+}
+
+// Sized versions, called instead of the ones above by C++14 compilers when the size is known
+void operator delete(void *p, std::size_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    deallocate(p);
+}
+
+struct suite
+{
+    const char                  *name;
+    std::function<bool()>       run;    // Returns false when a check failed
+};
+
+//--------------------------------------------------------------------------------------------------
+void print_header(const char *name)
+{
+    std::cout << "-------------------------------------------------------------------" << std::endl;
+    std::cout << name << std::endl;
+    std::cout << "-------------------------------------------------------------------" << std::endl;
+}
+
+double seconds_since(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+// 1, 2, 4... up to the number of hardware threads, which is always included
+std::vector<uint32_t> worker_counts()
+{
+    const auto hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint32_t> counts;
+    for (uint32_t count = 1; count < hardwareThreads; count *= 2)
+    {
+        counts.push_back(count);
+    }
+    counts.push_back(hardwareThreads);
+    return counts;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// 64 producers write records of varying sizes in a small mpsc_ring_buffer, so that records wrap
+// around its end and producers race for the last bytes. The consumer reads them piecewise, size
+// first, and checks that every record of every producer arrives once, in order and intact.
+bool mpsc_ring_buffer_stress()
+{
+    print_header(__FUNCTION__);
+
+    static constexpr uint32_t producerCount = 64;
+    static constexpr uint32_t recordsPerProducer = 20000;
+    static constexpr uint16_t maxPayloadSize = 200;
+
+    // size u16, producer u16, sequence u32, then payload bytes derived from all of them
+    const auto recordSize = [](uint32_t producer, uint32_t sequence)
+    {
+        return uint16_t(8 + (producer * 7 + sequence * 13) % maxPayloadSize);
+    };
+    const auto payloadByte = [](uint32_t producer, uint32_t sequence, uint32_t i)
+    {
+        return uint8_t(producer * 31 + sequence * 17 + i);
+    };
+
+    mpsc_ring_buffer buffer(16 * 1024);
+    uint64_t emptyCount = 0;
+    std::atomic<uint64_t> retries(0);
+
+    const auto start = clock_type::now();
+    std::vector<std::thread> producers;
+    for (uint32_t p = 0; p < producerCount; ++p)
+    {
+        producers.emplace_back([&, p]
+        {
+            uint8_t record[8 + maxPayloadSize];
+            uint64_t localRetries = 0;
+            for (uint32_t s = 0; s < recordsPerProducer; ++s)
+            {
+                const auto size = recordSize(p, s);
+                const auto producer = uint16_t(p);
+                memcpy(record, &size, sizeof(size));
+                memcpy(record + 2, &producer, sizeof(producer));
+                memcpy(record + 4, &s, sizeof(s));
+                for (uint32_t i = 8; i < size; ++i)
+                {
+                    record[i] = payloadByte(p, s, i);
+                }
+                while (!buffer.write(record, int32_t(size)))
+                {
+                    ++localRetries;
+                    std::this_thread::yield();
+                }
+            }
+            retries += localRetries;
+        });
+    }
+
+    std::vector<uint32_t> nextSequence(producerCount, 0);
+    uint64_t received = 0, errors = 0;
+    uint8_t record[8 + maxPayloadSize];
+    while (received < uint64_t(producerCount) * recordsPerProducer)
+    {
+        uint16_t size = 0;
+        if (!buffer.read(size))
+        {
+            ++emptyCount;
+            std::this_thread::yield();
+            continue;
+        }
+
+        memcpy(record, &size, sizeof(size));
+        if (size < 8 || size > sizeof(record) || !buffer.read(record + 2, size - 2))
+        {
+            std::cout << "torn record of " << size << " bytes" << std::endl;
+            // Producers may be waiting for room forever
+            for (auto &t : producers)
+            {
+                t.detach();
+            }
+            return false;
+        }
+
+        uint16_t producer = 0;
+        uint32_t sequence = 0;
+        memcpy(&producer, record + 2, sizeof(producer));
+        memcpy(&sequence, record + 4, sizeof(sequence));
+        bool valid = producer < producerCount && sequence == nextSequence[producer] && size == recordSize(producer, sequence);
+        for (uint32_t i = 8; valid && i < size; ++i)
+        {
+            valid = record[i] == payloadByte(producer, sequence, i);
+        }
+        if (!valid)
+        {
+            ++errors;
+        }
+        if (producer < producerCount)
+        {
+            nextSequence[producer] = sequence + 1;
+        }
+        ++received;
+    }
+
+    for (auto &t : producers)
+    {
+        t.join();
+    }
+    const auto duration = seconds_since(start);
+
+    std::cout << received << " records from " << producerCount << " producers in " << duration << "s, "
+        << std::fixed << std::setprecision(2) << received / duration / 1e6 << " Mrecords/s" << std::defaultfloat << std::endl;
+    std::cout << "buffer full " << retries.load() << " times, empty " << emptyCount << " times" << std::endl;
+    std::cout << errors << " invalid records, " << buffer.usedSpace() << " bytes left" << std::endl;
+    return errors == 0 && buffer.usedSpace() == 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Every worker pushes then pops in a loop, all on the same queue, as workers scheduling tasks do.
+// Note that this is the best case of work_stealing_queue: workers mostly pop what they pushed.
+// Elements are shared pointers, like oqpi::task_handle, and are moved in and out.
+// Returns the throughput in millions of operations (push or pop) per second, or 0 if an element
+// got lost or duplicated.
+template<typename _Queue>
+double measure_queue_contention(uint32_t workerCount, uint32_t pairsPerWorker)
+{
+    _Queue queue;
+    std::atomic<uint64_t> poppedSum(0);
+    std::atomic<uint32_t> ready(0);
+
+    std::vector<std::thread> workers;
+    for (uint32_t w = 0; w < workerCount; ++w)
+    {
+        workers.emplace_back([&, w]
+        {
+            ++ready;
+            while (ready.load() < workerCount)
+            {
+                std::this_thread::yield();
+            }
+
+            uint64_t localSum = 0;
+            for (uint32_t i = 0; i < pairsPerWorker; ++i)
+            {
+                queue.push(std::make_shared<uint64_t>(uint64_t(w) * pairsPerWorker + i));
+                std::shared_ptr<uint64_t> spValue;
+                if (queue.try_pop(spValue))
+                {
+                    localSum += *spValue;
+                }
+            }
+            poppedSum += localSum;
+        });
+    }
+
+    const auto start = clock_type::now();
+    for (auto &t : workers)
+    {
+        t.join();
+    }
+    const auto duration = seconds_since(start);
+
+    // Whatever other workers popped in between is left over
+    uint64_t sum = poppedSum.load();
+    std::shared_ptr<uint64_t> spValue;
+    while (queue.try_pop(spValue))
+    {
+        sum += *spValue;
+    }
+
+    const auto total = uint64_t(workerCount) * pairsPerWorker;
+    if (!queue.empty() || sum != total * (total - 1) / 2)
+    {
+        return 0.0;
+    }
+    return total * 2 / duration / 1e6;
+}
+
+bool queue_contention()
+{
+    print_header(__FUNCTION__);
+
+    static constexpr uint32_t pairsPerWorker = 200000;
+
+    bool succeeded = true;
+    std::cout << "Mops/s, speedup against qqueue" << std::endl;
+    std::cout << "workers          qqueue          mpmc_queue          work_stealing_queue" << std::endl;
+    for (const auto workerCount : worker_counts())
+    {
+        using element = std::shared_ptr<uint64_t>;
+        const auto locked = measure_queue_contention<qqueue<element, std::mutex>>(workerCount, pairsPerWorker);
+        const auto lockFree = measure_queue_contention<mpmc_queue<element>>(workerCount, pairsPerWorker);
+        const auto stealing = measure_queue_contention<work_stealing_queue<element>>(workerCount, pairsPerWorker);
+        succeeded &= locked > 0.0 && lockFree > 0.0 && stealing > 0.0;
+
+        std::cout << std::setw(7) << workerCount
+            << std::fixed << std::setprecision(2)
+            << std::setw(16) << locked
+            << std::setw(12) << lockFree << " (" << std::setw(5) << (locked > 0.0 ? lockFree / locked : 0.0) << "x)"
+            << std::setw(14) << stealing << " (" << std::setw(5) << (locked > 0.0 ? stealing / locked : 0.0) << "x)"
+            << std::defaultfloat << std::endl;
+    }
+
+    // Once a worker has its deque, moving elements in and out of it doesn't allocate
+    {
+        static constexpr uint32_t pairCount = 10000;
+
+        work_stealing_queue<std::shared_ptr<uint64_t>> queue;
+        auto spValue = std::make_shared<uint64_t>(0);
+        queue.try_pop(spValue);
+        queue.push(std::move(spValue));
+        queue.try_pop(spValue);
+
+        const auto before = thread_allocation_count();
+        for (uint32_t i = 0; i < pairCount; ++i)
+        {
+            queue.push(std::move(spValue));
+            queue.try_pop(spValue);
+        }
+        const auto allocations = thread_allocation_count() - before;
+        std::cout << "work_stealing_queue: " << allocations << " allocations for " << pairCount << " push/pop pairs" << std::endl;
+        succeeded &= (allocations == 0);
+    }
+
+    // Threads give their deque back when they exit, the ones started later still get one
+    {
+        static constexpr uint32_t threadCount = 256;
+
+        work_stealing_queue<uint32_t> queue;
+        uint32_t withDeque = 0;
+        for (uint32_t i = 0; i < threadCount; ++i)
+        {
+            std::thread([&queue, &withDeque]
+            {
+                // Deques are LIFO, the injection queue FIFO
+                uint32_t first = 0, second = 0;
+                queue.try_pop(first);
+                queue.push(1u);
+                queue.push(2u);
+                queue.try_pop(first);
+                queue.try_pop(second);
+                withDeque += (first == 2);
+            }).join();
+        }
+        std::cout << "work_stealing_queue: " << withDeque << " of " << threadCount << " short-lived threads had a deque" << std::endl;
+        succeeded &= (withDeque == threadCount);
+    }
+    return succeeded;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Cost of timer_task_context and timer_group_context per task.
+//
+// The same parallel group of tasks spinning for a given time is run by schedulers whose contexts are
+// instrumented, one per transport of the records to the server, and by one whose contexts do
+// nothing. The time measured goes from the creation of the tasks, which is where names get
+// registered, to the end of the group.
+//
+// oqpi_tk::scheduler() is a single instance per toolkit type, each configuration (worker count,
+// instrumented or not) is thus given toolkit types of its own through no-op contexts tagged with
+// the index of the configuration.
+//--------------------------------------------------------------------------------------------------
+void spin_for(uint64_t ns)
+{
+    const auto until = clock_type::now() + std::chrono::nanoseconds(ns);
+    while (clock_type::now() < until)
+    {}
+}
+
+template<int _Slot>
+class slot_task_context
+    : public oqpi::task_context_base
+{
+public:
+    slot_task_context(oqpi::task_base *pOwner, const std::string &name)
+        : oqpi::task_context_base(pOwner, name)
+    {}
+
+    inline void onAddedToGroup(const oqpi::task_group_sptr &) {}
+    inline void onPreExecute() {}
+    inline void onPostExecute() {}
+};
+
+template<int _Slot>
+class slot_group_context
+    : public oqpi::group_context_base
+{
+public:
+    slot_group_context(oqpi::task_group_base *pOwner, const std::string &name)
+        : oqpi::group_context_base(pOwner, name)
+    {}
+
+    inline void onAddedToGroup(const oqpi::task_group_sptr &) {}
+    inline void onPreExecute() {}
+    inline void onPostExecute() {}
+};
+
+template<typename T>
+using benchmark_queue = mpmc_queue<T>;
+
+// Ticks of telemetry_clock under a type of its own: the records of the contexts using it go through
+// a connection of their own, which the sink keeps on TCP
+struct tcp_telemetry_clock : telemetry_clock
+{};
+
+struct tcp_telemetry : full_trace_telemetry
+{
+    using clock = tcp_telemetry_clock;
+    using sink  = network_sink<clock>;
+};
+
+template<int _Slot, bool _Instrumented, typename _Policy = full_trace_telemetry>
+using overhead_tk = oqpi::helpers
+<
+    oqpi::scheduler<benchmark_queue>,
+    typename std::conditional<_Instrumented,
+        oqpi::group_context_container<basic_timer_group_context<_Policy>, slot_group_context<_Slot>>,
+        oqpi::group_context_container<slot_group_context<_Slot>>>::type,
+    typename std::conditional<_Instrumented,
+        oqpi::task_context_container<basic_timer_task_context<_Policy>, slot_task_context<_Slot>>,
+        oqpi::task_context_container<slot_task_context<_Slot>>>::type
+>;
+
+// Stands in for the telemetry server when none runs locally, everything sent is read and dropped
+// unless the connection was asked to keep it. Connections are accepted one at a time, each client is
+// offered the transport asked for when its registry connects, see connect_telemetry(). Created
+// before the registries connect, it is destroyed after they disconnect.
+class local_telemetry_sink
+{
+    struct received_stream
+    {
+        std::mutex              mutex;
+        std::vector<uint8_t>    bytes;
+    };
+    using received_streams = std::vector<std::shared_ptr<received_stream>>;
+
+public:
+    static local_telemetry_sink& get()
+    {
+        static local_telemetry_sink sink;
+        return sink;
+    }
+
+    // False when another server listens on the port
+    bool listening() const
+    {
+        return acceptThread_.joinable();
+    }
+
+    // Whether the shared memory rings offered by the next clients are read, rather than refused
+    void acceptSharedMemory(bool accept)
+    {
+        acceptSharedMemory_.store(accept);
+    }
+
+    // Whether the next connections keep the frames they receive, see received()
+    void keepReceived(bool keep)
+    {
+        keepReceived_.store(keep);
+    }
+
+    // Frames received so far by the index-th connection that keeps them, in the order they were sent
+    std::vector<uint8_t> received(size_t index)
+    {
+        std::shared_ptr<received_stream> spStream;
+        {
+            std::lock_guard<std::mutex> __l(receivedMutex_);
+            if (index >= receivedStreams_.size())
+            {
+                return std::vector<uint8_t>();
+            }
+            spStream = receivedStreams_[index];
+        }
+        std::lock_guard<std::mutex> __l(spStream->mutex);
+        return spStream->bytes;
+    }
+
+private:
+    local_telemetry_sink()
+        : acceptor_(ioService_)
+        , acceptSharedMemory_(true)
+        , keepReceived_(false)
+        , stopping_(false)
+    {
+        asio::error_code error;
+        const asio::ip::tcp::endpoint endPoint(asio::ip::tcp::v4(), 9000);
+        acceptor_.open(endPoint.protocol(), error);
+        if (!error)
+        {
+            // The connections of a previous run may still hold the port
+            acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true), error);
+        }
+        if (!error)
+        {
+            acceptor_.bind(endPoint, error);
+        }
+        if (!error)
+        {
+            acceptor_.listen(asio::socket_base::max_connections, error);
+        }
+        if (error)
+        {
+            std::cout << "port 9000 already in use, sending to the server listening on it" << std::endl;
+            return;
+        }
+
+        acceptThread_ = std::thread([this]
+        {
+            for (;;)
+            {
+                auto spSocket = std::make_shared<asio::ip::tcp::socket>(ioService_);
+                asio::error_code error;
+                acceptor_.accept(*spSocket, error);
+                if (error || stopping_.load())
+                {
+                    break;
+                }
+                std::shared_ptr<received_stream> spStream;
+                if (keepReceived_.load())
+                {
+                    spStream = std::make_shared<received_stream>();
+                    std::lock_guard<std::mutex> __l(receivedMutex_);
+                    receivedStreams_.push_back(spStream);
+                }
+
+                // The client waits for the answer to its shared memory offer before connecting the next
+                std::shared_ptr<shared_memory_ring> spRing = answerSharedMemoryOffer(*spSocket, spStream.get());
+                connectionThreads_.emplace_back([spSocket, spRing, spStream]
+                {
+                    receive(*spSocket, spRing.get(), spStream.get());
+                });
+            }
+        });
+    }
+
+    ~local_telemetry_sink()
+    {
+        if (!acceptThread_.joinable())
+        {
+            return;
+        }
+
+        // Wakes the accepting thread up
+        stopping_.store(true);
+        asio::ip::tcp::socket socket(ioService_);
+        asio::error_code error;
+        socket.connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 9000), error);
+        acceptThread_.join();
+
+        for (auto &thread : connectionThreads_)
+        {
+            thread.join();
+        }
+    }
+
+    // A local client first offers to move to shared memory and waits for the answer
+    std::unique_ptr<shared_memory_ring> answerSharedMemoryOffer(asio::ip::tcp::socket &socket, received_stream *pStream)
+    {
+        frame_header header;
+        asio::error_code error;
+        asio::read(socket, asio::buffer(&header, sizeof(header)), error);
+        if (error || header.op != opcode::attach_shared_memory || header.size != sizeof(header) + sizeof(shared_memory_record))
+        {
+            // Only the clock frame can come first, the rest of it follows on the socket
+            if (!error)
+            {
+                keep(pStream, reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+            }
+            return nullptr;
+        }
+
+        shared_memory_record record;
+        asio::read(socket, asio::buffer(&record, sizeof(record)), error);
+        record.name[sizeof(record.name) - 1] = 0;
+
+        std::unique_ptr<shared_memory_ring> spRing;
+        if (!error && acceptSharedMemory_.load())
+        {
+            try
+            {
+                spRing = shared_memory_ring::open(record.name);
+            }
+            catch (std::exception &e)
+            {
+                std::cout << e.what() << std::endl;
+            }
+        }
+
+        const uint8_t accepted = spRing ? 1 : 0;
+        asio::write(socket, asio::buffer(&accepted, sizeof(accepted)), error);
+        return spRing;
+    }
+
+    // Until the client disconnects, the socket only tells when it does once frames go through the ring
+    static void receive(asio::ip::tcp::socket &socket, shared_memory_ring *pRing, received_stream *pStream)
+    {
+        std::vector<uint8_t> buffer(64 * 1024);
+        asio::error_code error;
+        if (!pRing)
+        {
+            for (;;)
+            {
+                const auto size = socket.read_some(asio::buffer(buffer), error);
+                if (error)
+                {
+                    return;
+                }
+                keep(pStream, buffer.data(), size);
+            }
+        }
+
+        socket.non_blocking(true);
+        while (!error || error == asio::error::would_block)
+        {
+            keep(pStream, buffer.data(), pRing->read(buffer.data(), buffer.size(), std::chrono::milliseconds(10)));
+            socket.read_some(asio::buffer(buffer), error);
+        }
+        // The client wrote its last frames before disconnecting
+        while (const auto size = pRing->read(buffer.data(), buffer.size(), std::chrono::milliseconds(0)))
+        {
+            keep(pStream, buffer.data(), size);
+        }
+    }
+
+    static void keep(received_stream *pStream, const uint8_t *data, size_t size)
+    {
+        if (pStream && size > 0)
+        {
+            std::lock_guard<std::mutex> __l(pStream->mutex);
+            pStream->bytes.insert(pStream->bytes.end(), data, data + size);
+        }
+    }
+
+private:
+    asio::io_service            ioService_;
+    asio::ip::tcp::acceptor     acceptor_;
+    std::atomic<bool>           acceptSharedMemory_;
+    std::atomic<bool>           keepReceived_;
+    std::atomic<bool>           stopping_;
+    std::thread                 acceptThread_;
+    std::vector<std::thread>    connectionThreads_;     // Only accessed by the accepting thread, then joined
+    std::mutex                  receivedMutex_;
+    received_streams            receivedStreams_;
+};
+
+// Connects the registry of the given clock, through shared memory or TCP unless the registry was
+// already connected or another server listens instead of the sink
+template<typename _Clock>
+basic_timing_registry<_Clock>& connect_telemetry(bool sharedMemory)
+{
+    local_telemetry_sink::get().acceptSharedMemory(sharedMemory);
+    return basic_timing_registry<_Clock>::get();
+}
+
+const char* transport_name(bool sharedMemory)
+{
+    return sharedMemory ? "shared memory" : "TCP";
+}
+
+// Seconds from the creation of taskCount tasks of taskNs each to the end of their parallel group
+template<typename _Toolkit>
+double run_parallel_group(uint32_t taskCount, uint64_t taskNs)
+{
+    const auto prio = oqpi::task_priority::normal;
+    const auto start = clock_type::now();
+    auto spGroup = _Toolkit::template make_parallel_group<oqpi::task_type::waitable>("OverheadGroup", prio, int(taskCount));
+    for (uint32_t i = 0; i < taskCount; ++i)
+    {
+        spGroup->addTask(_Toolkit::make_task_item("OverheadTask", prio, [taskNs]
+        {
+            spin_for(taskNs);
+        }));
+    }
+    _Toolkit::schedule_task(oqpi::task_handle(spGroup)).wait();
+    return seconds_since(start);
+}
+
+template<typename _Toolkit>
+void start_workers(uint32_t workerCount)
+{
+    auto config = oqpi::worker_config{};
+    config.threadAttributes.coreAffinityMask_ = oqpi::core_affinity::all_cores;
+    config.threadAttributes.name_ = "oqpi::benchmark_worker";
+    config.threadAttributes.priority_ = oqpi::thread_priority::highest;
+    config.workerPrio = oqpi::worker_priority::wprio_any;
+    config.count = int(workerCount);
+    _Toolkit::scheduler().template registerWorker<oqpi::thread_interface<>, oqpi::semaphore_interface<>>(config);
+    _Toolkit::scheduler().start();
+}
+
+// Best of a few runs, after a warm up one
+template<typename _Toolkit>
+double best_run(uint32_t taskCount, uint64_t taskNs)
+{
+    static constexpr int runCount = 5;
+
+    run_parallel_group<_Toolkit>(taskCount, taskNs);
+    auto best = run_parallel_group<_Toolkit>(taskCount, taskNs);
+    for (int i = 1; i < runCount; ++i)
+    {
+        best = std::min(best, run_parallel_group<_Toolkit>(taskCount, taskNs));
+    }
+    return best;
+}
+
+static constexpr int max_overhead_slots = 8;
+
+template<int _Slot>
+typename std::enable_if<(_Slot >= max_overhead_slots)>::type measure_instrumentation_overhead(const std::vector<uint32_t> &)
+{}
+
+template<int _Slot>
+typename std::enable_if<(_Slot < max_overhead_slots)>::type measure_instrumentation_overhead(const std::vector<uint32_t> &workerCounts)
+{
+    if (_Slot >= int(workerCounts.size()))
+    {
+        return;
+    }
+
+    using baseline = overhead_tk<_Slot, false>;
+    using instrumented = overhead_tk<_Slot, true>;
+    using tcp_instrumented = overhead_tk<_Slot, true, tcp_telemetry>;
+    const auto workerCount = workerCounts[_Slot];
+    start_workers<baseline>(workerCount);
+    start_workers<instrumented>(workerCount);
+    start_workers<tcp_instrumented>(workerCount);
+
+    const auto sharedMemory = timing_registry::get().usesSharedMemory();
+    const auto tcpSharedMemory = basic_timing_registry<tcp_telemetry_clock>::get().usesSharedMemory();
+    for (const uint64_t taskNs : { 0ull, 1000ull, 10000ull, 100000ull })
+    {
+        // About 20ms of work per run
+        const auto taskCount = uint32_t(std::min<uint64_t>(50000, std::max<uint64_t>(2000, 20000000ull * workerCount / std::max<uint64_t>(taskNs, 1))));
+        const auto baselineNs = best_run<baseline>(taskCount, taskNs) * 1e9 / taskCount;
+        const auto instrumentedNs = best_run<instrumented>(taskCount, taskNs) * 1e9 / taskCount;
+        const auto tcpInstrumentedNs = best_run<tcp_instrumented>(taskCount, taskNs) * 1e9 / taskCount;
+
+        for (const auto &run : { std::make_pair(sharedMemory, instrumentedNs), std::make_pair(tcpSharedMemory, tcpInstrumentedNs) })
+        {
+            std::cout << std::setw(7) << workerCount
+                << std::setw(12) << taskNs / 1000
+                << std::setw(15) << transport_name(run.first)
+                << std::fixed << std::setprecision(1)
+                << std::setw(14) << baselineNs
+                << std::setw(16) << run.second
+                << std::setw(14) << run.second - baselineNs
+                << std::setw(12) << (1.0 - baselineNs / run.second) * 100.0 << "%"
+                << std::defaultfloat << std::endl;
+        }
+    }
+
+    baseline::scheduler().stop();
+    instrumented::scheduler().stop();
+    tcp_instrumented::scheduler().stop();
+
+    measure_instrumentation_overhead<_Slot + 1>(workerCounts);
+}
+
+bool instrumentation_overhead()
+{
+    print_header(__FUNCTION__);
+    connect_telemetry<telemetry_clock>(true);
+    connect_telemetry<tcp_telemetry_clock>(false);
+
+    auto workerCounts = worker_counts();
+    if (workerCounts.size() > max_overhead_slots)
+    {
+        // Keep the largest counts
+        workerCounts.erase(workerCounts.begin(), workerCounts.end() - max_overhead_slots);
+    }
+
+    std::cout << "ns/task is the wall time of a group divided by its number of tasks" << std::endl;
+    std::cout << "workers   task (us)      transport      baseline    instrumented      overhead     throughput" << std::endl;
+    std::cout << "                                         ns/task         ns/task       ns/task           loss" << std::endl;
+    measure_instrumentation_overhead<0>(workerCounts);
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Checks that, once a thread staged its first record and saw the names it uses, instrumenting a task
+// doesn't touch the heap: neither the contexts of a task and of its group, nor the steal records.
+// The allocations of the tasks themselves are oqpi's, they are not part of the measure.
+//--------------------------------------------------------------------------------------------------
+bool allocation_free_instrumentation()
+{
+    print_header(__FUNCTION__);
+    connect_telemetry<telemetry_clock>(true);
+
+    using toolkit = overhead_tk<0, false>;
+    static constexpr int taskCount = 100000;
+
+    const auto prio = oqpi::task_priority::normal;
+    const std::string taskName = "AllocationFreeTask";
+    const std::string groupName = "AllocationFreeGroup";
+    auto spTask = toolkit::make_task(taskName, prio, [] {});
+    auto spGroup = toolkit::make_parallel_group<oqpi::task_type::waitable>(groupName, prio, 1);
+    const oqpi::task_group_sptr spParentGroup = spGroup;
+
+    const auto instrumentTask = [&]
+    {
+        timer_group_context gc(spGroup.get(), groupName);
+        gc.onPreExecute();
+
+        timer_task_context tc(spTask.get(), taskName);
+        tc.onAddedToGroup(spParentGroup);
+        tc.onPreExecute();
+        tc.onPostExecute();
+        timer_steal_observer::on_steal(timer_steal_observer::thread_tag());
+
+        gc.onPostExecute();
+    };
+
+    // Per thread staging buffer, then shared one
+    auto success = true;
+    for (const auto shared : { false, true })
+    {
+        uint64_t allocations = 0;
+        std::thread([&]
+        {
+            if (shared)
+            {
+                timing_registry::get().useSharedStagingBuffer();
+            }
+
+            instrumentTask();
+            const auto before = thread_allocation_count();
+            for (auto i = 0; i < taskCount; ++i)
+            {
+                instrumentTask();
+            }
+            allocations = thread_allocation_count() - before;
+        }).join();
+
+        std::cout << (shared ? "shared" : "per thread") << " staging buffer: "
+            << allocations << " allocations for " << taskCount << " tasks" << std::endl;
+        success &= (allocations == 0);
+    }
+    return success;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Checks that threads recording through two policies with different clocks send every record on the
+// connection of its clock, referring to names registered on that connection. One connection stays
+// on TCP, the other moves to shared memory.
+//--------------------------------------------------------------------------------------------------
+struct microsecond_clock
+{
+    static uint64_t now()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now().time_since_epoch()).count());
+    }
+
+    static uint64_t ticks_per_second()
+    {
+        return 1000000;
+    }
+};
+
+struct nanosecond_clock
+{
+    static uint64_t now()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count());
+    }
+
+    static uint64_t ticks_per_second()
+    {
+        return 1000000000;
+    }
+};
+
+template<typename _Clock>
+struct per_clock_telemetry : full_trace_telemetry
+{
+    using clock = _Clock;
+    using sink  = network_sink<clock>;
+};
+
+// What a connection received, decoded by frame_decoder
+struct received_records
+{
+    uint64_t                    ticksPerSecond  = 0;
+    std::vector<std::string>    names;
+    std::vector<task_info>      tasks;
+    uint64_t                    dropped         = 0;
+
+    void onClock(const clock_record &cr)
+    {
+        ticksPerSecond = cr.ticksPerSecond;
+    }
+
+    void onName(uint32_t nameId, const char *name, uint16_t length)
+    {
+        if (nameId >= names.size())
+        {
+            names.resize(nameId + 1);
+        }
+        names[nameId].assign(name, length);
+    }
+
+    void onGroup(const group_info &)
+    {}
+
+    void onTask(const task_info &ti)
+    {
+        tasks.push_back(ti);
+    }
+
+    void onSteal(const steal_info &)
+    {}
+
+    void onDropped(const dropped_info &di)
+    {
+        dropped += di.count;
+    }
+};
+
+// The complete frames of a stream, the last one may not have arrived entirely yet
+received_records decode_received(const std::vector<uint8_t> &stream)
+{
+    received_records records;
+    frame_decoder decoder;
+    for (size_t offset = 0; stream.size() - offset >= sizeof(frame_header);)
+    {
+        frame_header header;
+        memcpy(&header, stream.data() + offset, sizeof(header));
+        if (header.size < sizeof(header) || header.size > stream.size() - offset)
+        {
+            break;
+        }
+        decoder.decode(stream.data() + offset, header.size, records);
+        offset += header.size;
+    }
+    return records;
+}
+
+bool telemetry_per_clock()
+{
+    print_header(__FUNCTION__);
+    auto &sink = local_telemetry_sink::get();
+    if (!sink.listening())
+    {
+        std::cout << "skipped, the frames must be received by this process" << std::endl;
+        return true;
+    }
+
+    using us_telemetry = per_clock_telemetry<microsecond_clock>;
+    using ns_telemetry = per_clock_telemetry<nanosecond_clock>;
+    static constexpr uint32_t threadCount = 4;
+    static constexpr uint32_t tasksPerThread = 500;
+
+    // Kept by the sink in the order of the connections
+    sink.keepReceived(true);
+    connect_telemetry<microsecond_clock>(false);
+    auto &nsRegistry = connect_telemetry<nanosecond_clock>(true);
+    sink.keepReceived(false);
+
+    // The name ids of the two connections differ
+    nsRegistry.registerName("PerClockWarmUp");
+
+    using toolkit = overhead_tk<0, false>;
+    const auto prio = oqpi::task_priority::normal;
+    auto spUsTask = toolkit::make_task("MicrosecondTask", prio, [] {});
+    auto spNsTask = toolkit::make_task("NanosecondTask", prio, [] {});
+    const std::string names[] = { "PerClockTask0", "PerClockTask1", "PerClockTask2" };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([&]
+        {
+            for (uint32_t i = 0; i < tasksPerThread; ++i)
+            {
+                basic_timer_task_context<us_telemetry> usContext(spUsTask.get(), names[i % 3]);
+                usContext.onPreExecute();
+                usContext.onPostExecute();
+
+                basic_timer_task_context<ns_telemetry> nsContext(spNsTask.get(), names[(i + 1) % 3]);
+                nsContext.onPreExecute();
+                nsContext.onPostExecute();
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    // Tasks dropped on full staging buffers are reported instead
+    const auto expectedCount = uint64_t(threadCount) * tasksPerThread;
+    received_records connections[2];
+    const auto deadline = clock_type::now() + std::chrono::seconds(5);
+    do
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        connections[0] = decode_received(sink.received(0));
+        connections[1] = decode_received(sink.received(1));
+    }
+    while ((connections[0].tasks.size() + connections[0].dropped < expectedCount
+        || connections[1].tasks.size() + connections[1].dropped < expectedCount)
+        && clock_type::now() < deadline);
+
+    const struct
+    {
+        const char          *clockName;
+        uint64_t            ticksPerSecond;
+        oqpi::task_uid      uid;
+    } expected[] =
+    {
+        { "microsecond clock over TCP", microsecond_clock::ticks_per_second(), spUsTask->getUID() },
+        { "nanosecond clock over shared memory", nanosecond_clock::ticks_per_second(), spNsTask->getUID() },
+    };
+
+    auto success = true;
+    for (size_t c = 0; c < 2; ++c)
+    {
+        const auto &records = connections[c];
+        uint64_t misrouted = 0;
+        uint64_t unregistered = 0;
+        for (const auto &ti : records.tasks)
+        {
+            misrouted += (ti.uid != expected[c].uid);
+            unregistered += (ti.nameId >= records.names.size() || records.names[ti.nameId].compare(0, 12, "PerClockTask") != 0);
+        }
+
+        std::cout << expected[c].clockName << ": " << records.tasks.size() << " tasks, "
+            << records.dropped << " dropped, " << misrouted << " from the other clock, "
+            << unregistered << " with a name not registered on the connection, "
+            << records.ticksPerSecond << " ticks per second" << std::endl;
+        success &= records.ticksPerSecond == expected[c].ticksPerSecond
+            && records.tasks.size() + records.dropped == expectedCount
+            && misrouted == 0
+            && unregistered == 0;
+    }
+    return success;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Throughput of the shared memory transport: the sender thread of a client writes 64KB frames of
+// task_info records, the session of a server reads them. Both ends live in this process here, the
+// region still goes through shm_open and the doorbell through the futex.
+//--------------------------------------------------------------------------------------------------
+bool shared_memory_throughput()
+{
+    print_header(__FUNCTION__);
+#if OQPI_VISUALIZER_HAS_SHARED_MEMORY
+    static constexpr size_t frameSize = 64 * 1024;
+    static constexpr size_t recordsPerFrame = frameSize / sizeof(task_info);
+    static constexpr uint64_t frameCount = 50000;
+
+    const auto name = "/oqpi_benchmarks_" + std::to_string(getpid());
+    auto spProducer = shared_memory_ring::create(name, 8 * 1024 * 1024);
+    auto spConsumer = shared_memory_ring::open(name);
+    spProducer->unlink();
+
+    std::vector<uint8_t> frame(recordsPerFrame * sizeof(task_info));
+    for (size_t i = 0; i < recordsPerFrame; ++i)
+    {
+        task_info ti;
+        ti.uid = i + 1;
+        memcpy(frame.data() + i * sizeof(ti), &ti, sizeof(ti));
+    }
+
+    const auto start = clock_type::now();
+    std::atomic<bool> written(true);
+    std::thread producer([&]
+    {
+        for (uint64_t i = 0; i < frameCount && written; ++i)
+        {
+            written = spProducer->write(frame.data(), frame.size());
+        }
+    });
+
+    // Every byte must come out in order
+    const auto expectedSize = frameCount * frame.size();
+    std::vector<uint8_t> received(1024 * 1024);
+    uint64_t receivedSize = 0;
+    auto intact = true;
+    while (receivedSize < expectedSize)
+    {
+        const auto size = spConsumer->read(received.data(), received.size(), std::chrono::milliseconds(100));
+        if (size == 0 && !written)
+        {
+            break;
+        }
+        for (size_t checked = 0; checked < size;)
+        {
+            const auto offset = size_t((receivedSize + checked) % frame.size());
+            const auto sliceSize = std::min(size - checked, frame.size() - offset);
+            intact &= memcmp(received.data() + checked, frame.data() + offset, sliceSize) == 0;
+            checked += sliceSize;
+        }
+        receivedSize += size;
+    }
+    producer.join();
+    const auto elapsed = seconds_since(start);
+
+    std::cout << std::fixed << std::setprecision(1)
+        << receivedSize / elapsed / (1024.0 * 1024.0) << " MB/s, "
+        << frameCount * recordsPerFrame / elapsed / 1e6 << "M task records/s"
+        << std::defaultfloat << std::endl;
+
+    if (receivedSize != expectedSize || !intact)
+    {
+        std::cout << "received " << receivedSize << " of " << expectedSize << " bytes, "
+            << (intact ? "intact" : "corrupted") << std::endl;
+        return false;
+    }
+#else
+    std::cout << "shared memory is not supported on this platform" << std::endl;
+#endif
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Size and speed of task_column_codec on batches shaped like what a client drains: runs of tasks
+// from one thread at a time, increasing uids, durations and queue waits of a few microseconds in
+// nanoseconds.
+// Every batch must decode to the records it was encoded from.
+//--------------------------------------------------------------------------------------------------
+bool task_compression()
+{
+    print_header(__FUNCTION__);
+
+    static constexpr uint32_t batchSize = 64 * 1024 / sizeof(task_info);
+    static constexpr uint32_t threadCount = 8;
+    static constexpr uint32_t iterations = 2000;
+
+    std::vector<task_info> tasks(batchSize);
+    uint64_t now = 1000000000ull;
+    for (uint32_t i = 0; i < batchSize; ++i)
+    {
+        const auto thread = i * threadCount / batchSize;
+        auto &ti = tasks[i];
+        ti.uid              = 100000 + i * threadCount + thread;
+        ti.groupUID         = 500 + i / 256;
+        ti.nameId           = (i / 32) % 12;
+        ti.startedOnThread  = task_info::thread_id(4000 + thread);
+        ti.stoppedOnThread  = ti.startedOnThread;
+        ti.startedOnCore    = uint8_t(thread);
+        ti.stoppedOnCore    = uint8_t(thread);
+        now                += 200 + (i * 7919) % 3000;
+        ti.startedAt        = now;
+        ti.stoppedAt        = now + 2000 + (i * 104729) % 20000;
+        ti.priority         = uint8_t(oqpi::task_priority::normal);
+        // Sequence children run without going through the queue
+        ti.scheduledAt      = (i % 5 == 0) ? not_scheduled : now - (i * 6151) % 50000;
+    }
+    const auto records = reinterpret_cast<const uint8_t*>(tasks.data());
+    const auto rawSize = tasks.size() * sizeof(task_info);
+
+    task_column_codec codec;
+    std::vector<uint8_t> packed;
+    std::vector<task_info> decoded;
+    decoded.reserve(batchSize);
+
+    // Round trip first
+    codec.encode(records, batchSize, packed);
+    const auto consumed = codec.decode(packed.data(), packed.size(), batchSize, [&](const task_info &ti)
+    {
+        decoded.push_back(ti);
+    });
+    const auto intact = consumed == packed.size() && decoded.size() == tasks.size()
+        && memcmp(decoded.data(), tasks.data(), rawSize) == 0;
+
+    std::vector<uint8_t> copy(rawSize);
+    auto start = clock_type::now();
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        memcpy(copy.data(), records, rawSize);
+    }
+    const auto copySeconds = seconds_since(start);
+
+    start = clock_type::now();
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        packed.clear();
+        codec.encode(records, batchSize, packed);
+    }
+    const auto encodeSeconds = seconds_since(start);
+
+    uint64_t checksum = 0;
+    start = clock_type::now();
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        codec.decode(packed.data(), packed.size(), batchSize, [&](const task_info &ti)
+        {
+            checksum += ti.stoppedAt;
+        });
+    }
+    const auto decodeSeconds = seconds_since(start);
+
+    const auto megabytes = double(rawSize) * iterations / (1024.0 * 1024.0);
+    std::cout << std::fixed << std::setprecision(1)
+        << batchSize << " records: " << rawSize << " bytes packed in " << packed.size()
+        << " (" << double(packed.size()) / batchSize << " bytes/record, "
+        << double(rawSize) / packed.size() << "x)" << std::endl
+        << "memcpy " << megabytes / copySeconds << " MB/s, encode " << megabytes / encodeSeconds
+        << " MB/s, decode " << megabytes / decodeSeconds << " MB/s (of raw records)"
+        << std::defaultfloat << std::endl;
+
+    if (!intact || checksum == 0)
+    {
+        std::cout << "round trip failed" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    const suite suites[] =
+    {
+        { "mpsc_ring_buffer_stress", mpsc_ring_buffer_stress },
+        { "queue_contention", queue_contention },
+        { "instrumentation_overhead", instrumentation_overhead },
+        { "allocation_free_instrumentation", allocation_free_instrumentation },
+        { "telemetry_per_clock", telemetry_per_clock },
+        { "shared_memory_throughput", shared_memory_throughput },
+        { "task_compression", task_compression },
+    };
+
+    bool succeeded = true;
+    for (const auto &s : suites)
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i)
+        {
+            selected |= (s.name == std::string(argv[i]));
+        }
+
+        if (selected && !s.run())
+        {
+            std::cout << s.name << " FAILED" << std::endl;
+            succeeded = false;
+        }
+    }
+    return succeeded ? 0 : 1;
+}
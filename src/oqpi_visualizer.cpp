@@ -1,34 +1,90 @@
 #include <iostream>
+#include <iomanip>
 #include <queue>
 #include <mutex>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
 
 #include "oqpi.hpp"
 
-#include "cqueue.hpp"
+#include "histogram.hpp"
+#include "scheduled_queue.hpp"
 #include "timer_contexts.hpp"
+#include "work_stealing_queue.hpp"
+
+//--------------------------------------------------------------------------------------------------
+// Scheduler benchmark harness.
+//
+// Usage: oqpi_visualizer [--workers <n>] [--granularity <us>] [--fan-out <n>] [--repetitions <n>]
+//                        [--format csv|json] [--loop]
+//  --workers       worker threads of the scheduler, the hardware concurrency by default
+//  --granularity   busy time of every task in microseconds, 100 by default
+//  --fan-out       tasks per group (and work units of unit_task), the worker count by default
+//  --repetitions   timed runs of each scenario, after a warm up run, 10 by default
+//  --format        one line per scenario in csv (default) or a json array, on stdout
+//  --loop          runs the scenarios over and over, e.g. to feed the visualizer when tracing
+//
+// Every scenario reports:
+//  makespan        from the scheduling of its root task to its end, median and min of the runs
+//  tasks/s         tasks over the median makespan
+//  latency         from the moment a task can run (its root is scheduled, or the tasks it comes
+//                  after in a sequence are done) to the moment it starts, p50 and p99 of all the runs
+//  efficiency      time spent in tasks over workers * makespan, mean of the runs
+//
+// The tasks are instrumented according to telemetry_profile. It is no_telemetry by default so that
+// the numbers are the scheduler's own, building with OQPI_VISUALIZER_TRACE defined traces every
+// task instead, a telemetry server must then be listening.
+//--------------------------------------------------------------------------------------------------
 
-using namespace std::chrono_literals;
 
 //--------------------------------------------------------------------------------------------------
 // Types
 using thread = oqpi::thread_interface<>;
 using semaphore = oqpi::semaphore_interface<>;
+// full_trace_telemetry, release_telemetry or no_telemetry, see timer_contexts.hpp
+#if defined(OQPI_VISUALIZER_TRACE)
+using telemetry_profile = full_trace_telemetry;
+#else
+using telemetry_profile = no_telemetry;
+#endif
+template<typename T>
+using stealing_queue = work_stealing_queue<T, basic_timer_steal_observer<telemetry_profile>>;
+// Stamps the tasks when they are pushed, so that the server sees how long they waited
 template<typename T>
-using cqueue = qqueue<T, std::mutex>;
+using cqueue = typename std::conditional<telemetry_profile::enabled,
+    scheduled_queue<T, stealing_queue, telemetry_profile::clock>, stealing_queue<T>>::type;
 using scheduler_type = oqpi::scheduler<cqueue>;
-using gc = oqpi::group_context_container<timer_group_context>;
-using tc = oqpi::task_context_container<timer_task_context>;
+using gc = oqpi::group_context_container<basic_timer_group_context<telemetry_profile>>;
+using tc = oqpi::task_context_container<basic_timer_task_context<telemetry_profile>>;
 using oqpi_tk = oqpi::helpers<scheduler_type, gc, tc>;
+using clock_type = std::chrono::steady_clock;
+
+
+//--------------------------------------------------------------------------------------------------
+struct harness_config
+{
+    enum class output_format { csv, json };
+
+    uint32_t        workerCount     = thread::hardware_concurrency();
+    uint32_t        granularityUs   = 100;
+    int32_t         fanOut          = 0;    // The worker count when 0
+    int32_t         repetitions     = 10;
+    output_format   format          = output_format::csv;
+    bool            loop            = false;
+};
+
+static harness_config gConfig;
 
 
 //--------------------------------------------------------------------------------------------------
 void setup_environment()
 {
-    //     std::cout << "-------------------------------------------------------------------" << std::endl;
-    //     std::cout << __FUNCTION__ << std::endl;
-    //     std::cout << "-------------------------------------------------------------------" << std::endl;
-    const auto workerCount = thread::hardware_concurrency();
-    for (auto i = 0u; i < workerCount; ++i)
+    for (auto i = 0u; i < gConfig.workerCount; ++i)
     {
         auto config = oqpi::worker_config{};
         config.threadAttributes.coreAffinityMask_ = oqpi::core_affinity::all_cores;//oqpi::core_affinity(1 << i);
@@ -39,223 +95,413 @@ void setup_environment()
         oqpi_tk::scheduler().registerWorker<thread, semaphore>(config);
     }
 
-    timing_registry::get();
+    // The main thread only creates groups, it doesn't need a staging buffer of its own
+    telemetry_profile::sink::use_shared_staging_buffer();
 
     oqpi_tk::scheduler().start();
-    //    std::cout << std::endl << std::endl;
 }
 
 
 //--------------------------------------------------------------------------------------------------
-static constexpr auto gValue = 10000000ull;
-static const auto gTaskCount = int(thread::hardware_concurrency());
+// Busy waits for the granularity of the tasks
+void do_work(uint32_t us)
+{
+    const auto until = clock_type::now() + std::chrono::microseconds(us);
+    while (clock_type::now() < until)
+    {}
+}
+
 
 //--------------------------------------------------------------------------------------------------
-uint64_t fibonacci(uint64_t n)
+// Timestamps of the tasks of one run of a scenario.
+// The tasks are split in stages of tasksPerStage consecutive tasks, a stage can only start once the
+// previous one is done: a parallel group is a single stage, a sequence has a stage per task.
+class scenario_run
 {
-    uint64_t a = 1, b = 1;
-    for (uint64_t i = 3; i <= n; ++i)
+    struct task_sample
+    {
+        clock_type::time_point start;
+        clock_type::time_point end;
+    };
+
+public:
+    scenario_run(int32_t taskCount, int32_t tasksPerStage)
+        : samples_(taskCount)
+        , tasksPerStage_(tasksPerStage)
+    {}
+
+    int32_t taskCount() const
     {
-        uint64_t c = a + b;
-        a = b;
-        b = c;
+        return int32_t(samples_.size());
     }
-    return b;
-}
 
-//--------------------------------------------------------------------------------------------------
-void test_unit_task_result()
-{
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << __FUNCTION__ << std::endl;
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    auto spTask = oqpi_tk::make_task("FibonacciReturnResult", oqpi::task_priority::normal, fibonacci, gValue);
-    oqpi_tk::schedule_task(spTask);
-    std::cout << "Fibonacci(" << gValue << ") = " << spTask->waitForResult() << std::endl;
-
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << std::endl << std::endl;
-}
+    // Body of the i-th task doing workUnits times the granularity
+    std::function<void()> task(int32_t i, int32_t workUnits = 1)
+    {
+        auto pSample = &samples_[i];
+        return [pSample, workUnits]
+        {
+            pSample->start = clock_type::now();
+            for (auto u = 0; u < workUnits; ++u)
+            {
+                do_work(gConfig.granularityUs);
+            }
+            pSample->end = clock_type::now();
+        };
+    }
 
+    // For parallel for scenarios, whose items are timestamped by their index
+    void item(int32_t i)
+    {
+        task(i)();
+    }
 
-//--------------------------------------------------------------------------------------------------
-void test_unit_task()
-{
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << __FUNCTION__ << std::endl;
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    auto spTask = oqpi_tk::make_task("Fibonacci4x", oqpi::task_priority::normal, []
+    void scheduled()
     {
-        for (int i = 0; i < gTaskCount; ++i)
+        scheduledAt_ = clock_type::now();
+    }
+
+    void done()
+    {
+        doneAt_ = clock_type::now();
+    }
+
+    clock_type::duration makespan() const
+    {
+        return doneAt_ - scheduledAt_;
+    }
+
+    void recordLatencies(histogram &latencies) const
+    {
+        auto readyAt = scheduledAt_;
+        for (size_t first = 0; first < samples_.size(); first += tasksPerStage_)
         {
-            volatile auto a = 0ull;
-            a += fibonacci(gValue + a);
+            const auto last = std::min(samples_.size(), first + tasksPerStage_);
+            auto stageEnd = readyAt;
+            for (auto i = first; i < last; ++i)
+            {
+                latencies.record(uint64_t(std::max<int64_t>(0, nanoseconds(samples_[i].start - readyAt))));
+                stageEnd = std::max(stageEnd, samples_[i].end);
+            }
+            readyAt = stageEnd;
         }
-    });
-    oqpi_tk::schedule_task(spTask).wait();
+    }
+
+    // Time spent in tasks over the time the workers were available
+    double efficiency(uint32_t workerCount) const
+    {
+        int64_t busyNs = 0;
+        for (const auto &sample : samples_)
+        {
+            busyNs += nanoseconds(sample.end - sample.start);
+        }
+        return double(busyNs) / (double(workerCount) * double(std::max<int64_t>(1, nanoseconds(makespan()))));
+    }
+
+private:
+    static int64_t nanoseconds(clock_type::duration d)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    }
+
+private:
+    std::vector<task_sample>    samples_;
+    size_t                      tasksPerStage_;
+    clock_type::time_point      scheduledAt_;
+    clock_type::time_point      doneAt_;
+};
 
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << std::endl << std::endl;
+
+//--------------------------------------------------------------------------------------------------
+// Scenarios, each one fills a run from its own scheduling to its own end
+//--------------------------------------------------------------------------------------------------
+void test_unit_task(scenario_run &run)
+{
+    auto spTask = oqpi_tk::make_task("UnitTask", oqpi::task_priority::normal, run.task(0, gConfig.fanOut));
+    run.scheduled();
+    oqpi_tk::schedule_task(spTask).wait();
+    run.done();
 }
 
 
 //--------------------------------------------------------------------------------------------------
-void test_multiple_unit_tasks()
+void test_multiple_unit_tasks(scenario_run &run)
 {
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << __FUNCTION__ << std::endl;
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::vector<oqpi::task_handle> handles(gTaskCount);
-    for (auto i = 0; i < gTaskCount; ++i)
+    std::vector<oqpi::task_handle> handles(run.taskCount());
+    for (auto i = 0; i < run.taskCount(); ++i)
     {
-        handles[i] = oqpi_tk::make_task("Fibonacci4xWait", oqpi::task_priority::normal, fibonacci, gValue);
-        oqpi_tk::schedule_task(handles[i]);
+        handles[i] = oqpi_tk::make_task("UnitTaskWait", oqpi::task_priority::normal, run.task(i));
+    }
+    run.scheduled();
+    for (auto &h : handles)
+    {
+        oqpi_tk::schedule_task(h);
     }
     for (auto &h : handles)
     {
         h.wait();
     }
-
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << std::endl << std::endl;
+    run.done();
 }
 
 
 //--------------------------------------------------------------------------------------------------
-void test_sequence_group()
+void test_sequence_group(scenario_run &run)
 {
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << __FUNCTION__ << std::endl;
-    std::cout << "-------------------------------------------------------------------" << std::endl;
     auto spSeq = oqpi_tk::make_sequence_group<oqpi::task_type::waitable>("Sequence");
-    for (auto i = 0; i < gTaskCount; ++i)
+    for (auto i = 0; i < run.taskCount(); ++i)
     {
-        auto spTask = oqpi_tk::make_task_item("FibonacciSeq" + std::to_string(i), oqpi::task_priority::normal, fibonacci, gValue);
+        auto spTask = oqpi_tk::make_task_item("SequenceTask" + std::to_string(i), oqpi::task_priority::normal, run.task(i));
         spSeq->addTask(spTask);
     }
+    run.scheduled();
     oqpi_tk::schedule_task(oqpi::task_handle(spSeq)).wait();
-
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << std::endl << std::endl;
+    run.done();
 }
 
 
 //--------------------------------------------------------------------------------------------------
-void test_parallel_group()
+void test_parallel_group(scenario_run &run)
 {
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << __FUNCTION__ << std::endl;
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    auto spFork = oqpi_tk::make_parallel_group<oqpi::task_type::waitable>("Fork", oqpi::task_priority::normal, gTaskCount);
-    for (auto i = 0; i < gTaskCount; ++i)
+    auto spFork = oqpi_tk::make_parallel_group<oqpi::task_type::waitable>("Fork", oqpi::task_priority::normal, run.taskCount());
+    for (auto i = 0; i < run.taskCount(); ++i)
     {
-        auto spTask = oqpi_tk::make_task_item("FibonacciFork" + std::to_string(i), oqpi::task_priority::normal, fibonacci, gValue);
+        auto spTask = oqpi_tk::make_task_item("ForkTask" + std::to_string(i), oqpi::task_priority::normal, run.task(i));
         spFork->addTask(spTask);
     }
+    run.scheduled();
     oqpi_tk::schedule_task(oqpi::task_handle(spFork)).wait();
-
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << std::endl << std::endl;
+    run.done();
 }
 
 
 //--------------------------------------------------------------------------------------------------
-void test_sequence_of_parallel_groups()
+void test_sequence_of_parallel_groups(scenario_run &run)
 {
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << __FUNCTION__ << std::endl;
-    std::cout << "-------------------------------------------------------------------" << std::endl;
+    const auto fanOut = gConfig.fanOut;
     auto spSeq = oqpi_tk::make_sequence_group<oqpi::task_type::waitable>("Sequence");
-    for (auto i = 0; i < gTaskCount; ++i)
+    for (auto i = 0; i < fanOut; ++i)
     {
-        auto spFork = oqpi_tk::make_parallel_group<oqpi::task_type::fire_and_forget>("Fork" + std::to_string(i), oqpi::task_priority::normal, gTaskCount);
-        for (auto j = 0; j < gTaskCount; ++j)
+        auto spFork = oqpi_tk::make_parallel_group<oqpi::task_type::fire_and_forget>("Fork" + std::to_string(i), oqpi::task_priority::normal, fanOut);
+        for (auto j = 0; j < fanOut; ++j)
         {
-            auto spTask = oqpi_tk::make_task_item("Fibonacci_" + std::to_string(i * 10 + j), oqpi::task_priority::normal, fibonacci, gValue);
+            auto spTask = oqpi_tk::make_task_item("ForkTask_" + std::to_string(i * fanOut + j), oqpi::task_priority::normal, run.task(i * fanOut + j));
             spFork->addTask(spTask);
         }
         spSeq->addTask(oqpi::task_handle(spFork));
     }
+    run.scheduled();
     oqpi_tk::schedule_task(oqpi::task_handle(spSeq)).wait();
-
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << std::endl << std::endl;
+    run.done();
 }
 
 
 //--------------------------------------------------------------------------------------------------
-void test_parallel_for_task()
+// The items of a batch run one after the other: their latency includes the items before them
+void test_parallel_for_task(scenario_run &run)
 {
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << __FUNCTION__ << std::endl;
-    std::cout << "-------------------------------------------------------------------" << std::endl;
     const auto prio = oqpi::task_priority::normal;
-    const auto partitioner = oqpi::simple_partitioner(gTaskCount, oqpi_tk::scheduler().workersCount(prio));
-    auto spParallelForGroup = oqpi_tk::make_parallel_for_task_group<oqpi::task_type::waitable>("FibonacciParallelForGroup", partitioner, prio,
-        [](int32_t)
+    const auto partitioner = oqpi::simple_partitioner(run.taskCount(), oqpi_tk::scheduler().workersCount(prio));
+    auto spParallelForGroup = oqpi_tk::make_parallel_for_task_group<oqpi::task_type::waitable>("ParallelForGroup", partitioner, prio,
+        [&run](int32_t i)
     {
-        volatile auto a = 0ull;
-        a += fibonacci(gValue + a);
+        run.item(i);
     });
+    run.scheduled();
     oqpi_tk::schedule_task(oqpi::task_handle(spParallelForGroup)).wait();
-
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << std::endl << std::endl;
+    run.done();
 }
 
 
 //--------------------------------------------------------------------------------------------------
-void test_parallel_for()
+void test_parallel_for(scenario_run &run)
 {
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << __FUNCTION__ << std::endl;
-    std::cout << "-------------------------------------------------------------------" << std::endl;
     const auto prio = oqpi::task_priority::normal;
-    const auto partitioner = oqpi::simple_partitioner(gTaskCount, oqpi_tk::scheduler().workersCount(prio));
-    oqpi_tk::parallel_for("FibonacciParallelFor", partitioner, prio,
-        [](int32_t)
+    const auto partitioner = oqpi::simple_partitioner(run.taskCount(), oqpi_tk::scheduler().workersCount(prio));
+    run.scheduled();
+    oqpi_tk::parallel_for("ParallelFor", partitioner, prio,
+        [&run](int32_t i)
     {
-        volatile auto a = 0ull;
-        a += fibonacci(gValue + a);
+        run.item(i);
     });
+    run.done();
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Runs and reports
+//--------------------------------------------------------------------------------------------------
+struct scenario
+{
+    const char  *name;
+    void        (*run)(scenario_run &);
+    int32_t     taskCount;
+    int32_t     tasksPerStage;
+};
+
+struct scenario_result
+{
+    const char  *name;
+    int32_t     taskCount;
+    double      makespanMedianUs;
+    double      makespanMinUs;
+    double      tasksPerSecond;
+    double      latencyP50Us;
+    double      latencyP99Us;
+    double      efficiency;
+};
+
+scenario_result benchmark(const scenario &s)
+{
+    // Warm up
+    {
+        scenario_run run(s.taskCount, s.tasksPerStage);
+        s.run(run);
+    }
+
+    std::vector<double> makespansUs;
+    histogram latencies;
+    auto efficiency = 0.0;
+    for (auto r = 0; r < gConfig.repetitions; ++r)
+    {
+        scenario_run run(s.taskCount, s.tasksPerStage);
+        s.run(run);
+        makespansUs.push_back(std::chrono::duration<double, std::micro>(run.makespan()).count());
+        run.recordLatencies(latencies);
+        efficiency += run.efficiency(gConfig.workerCount);
+    }
+
+    std::sort(makespansUs.begin(), makespansUs.end());
+    scenario_result result;
+    result.name             = s.name;
+    result.taskCount        = s.taskCount;
+    result.makespanMedianUs = makespansUs[makespansUs.size() / 2];
+    result.makespanMinUs    = makespansUs.front();
+    result.tasksPerSecond   = s.taskCount * 1e6 / result.makespanMedianUs;
+    result.latencyP50Us     = latencies.valueAtPercentile(50.0) / 1000.0;
+    result.latencyP99Us     = latencies.valueAtPercentile(99.0) / 1000.0;
+    result.efficiency       = efficiency / gConfig.repetitions;
+    return result;
+}
 
-    std::cout << "-------------------------------------------------------------------" << std::endl;
-    std::cout << std::endl << std::endl;
+void print_results(const std::vector<scenario_result> &results)
+{
+    std::cout << std::fixed << std::setprecision(3);
+    if (gConfig.format == harness_config::output_format::csv)
+    {
+        std::cout << "scenario,workers,granularity_us,fan_out,repetitions,tasks,makespan_median_us,makespan_min_us,tasks_per_s,latency_p50_us,latency_p99_us,efficiency" << std::endl;
+        for (const auto &r : results)
+        {
+            std::cout << r.name << ',' << gConfig.workerCount << ',' << gConfig.granularityUs << ',' << gConfig.fanOut << ',' << gConfig.repetitions << ','
+                << r.taskCount << ',' << r.makespanMedianUs << ',' << r.makespanMinUs << ',' << r.tasksPerSecond << ','
+                << r.latencyP50Us << ',' << r.latencyP99Us << ',' << r.efficiency << std::endl;
+        }
+    }
+    else
+    {
+        std::cout << "[" << std::endl;
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const auto &r = results[i];
+            std::cout << "  {\"scenario\":\"" << r.name << "\",\"workers\":" << gConfig.workerCount << ",\"granularity_us\":" << gConfig.granularityUs
+                << ",\"fan_out\":" << gConfig.fanOut << ",\"repetitions\":" << gConfig.repetitions << ",\"tasks\":" << r.taskCount
+                << ",\"makespan_median_us\":" << r.makespanMedianUs << ",\"makespan_min_us\":" << r.makespanMinUs << ",\"tasks_per_s\":" << r.tasksPerSecond
+                << ",\"latency_p50_us\":" << r.latencyP50Us << ",\"latency_p99_us\":" << r.latencyP99Us << ",\"efficiency\":" << r.efficiency
+                << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+        }
+        std::cout << "]" << std::endl;
+    }
 }
 
 
 //--------------------------------------------------------------------------------------------------
 void clean_up_environement()
 {
-    oqpi::this_thread::sleep_for(500ms);
     oqpi_tk::scheduler().stop();
 }
 
 
 //--------------------------------------------------------------------------------------------------
-int main()
+bool parse_arguments(int argc, char **argv)
 {
-    setup_environment();
-    oqpi::this_thread::sleep_for(5ms);
-    while (true)
+    for (auto i = 1; i < argc; ++i)
+    {
+        const auto hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--workers") == 0 && hasValue)
+        {
+            gConfig.workerCount = uint32_t(std::max(1, atoi(argv[++i])));
+        }
+        else if (strcmp(argv[i], "--granularity") == 0 && hasValue)
+        {
+            gConfig.granularityUs = uint32_t(std::max(0, atoi(argv[++i])));
+        }
+        else if (strcmp(argv[i], "--fan-out") == 0 && hasValue)
+        {
+            gConfig.fanOut = std::max(1, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--repetitions") == 0 && hasValue)
+        {
+            gConfig.repetitions = std::max(1, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--format") == 0 && hasValue && strcmp(argv[i + 1], "csv") == 0)
+        {
+            gConfig.format = harness_config::output_format::csv;
+            ++i;
+        }
+        else if (strcmp(argv[i], "--format") == 0 && hasValue && strcmp(argv[i + 1], "json") == 0)
+        {
+            gConfig.format = harness_config::output_format::json;
+            ++i;
+        }
+        else if (strcmp(argv[i], "--loop") == 0)
+        {
+            gConfig.loop = true;
+        }
+        else
+        {
+            std::cerr << "Unknown argument: " << argv[i] << std::endl;
+            return false;
+        }
+    }
+
+    if (gConfig.fanOut == 0)
     {
-        test_unit_task_result();
-        oqpi::this_thread::sleep_for(5ms);
-        test_unit_task();
-        oqpi::this_thread::sleep_for(5ms);
-        test_multiple_unit_tasks();
-        oqpi::this_thread::sleep_for(5ms);
-        test_sequence_group();
-        oqpi::this_thread::sleep_for(5ms);
-        test_parallel_group();
-        oqpi::this_thread::sleep_for(5ms);
-        test_sequence_of_parallel_groups();
-        oqpi::this_thread::sleep_for(5ms);
-        test_parallel_for();
-        oqpi::this_thread::sleep_for(5ms);
-        test_parallel_for_task();
-         oqpi::this_thread::sleep_for(2s);
+        gConfig.fanOut = int32_t(gConfig.workerCount);
     }
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    if (!parse_arguments(argc, argv))
+    {
+        return 1;
+    }
+
+    const auto fanOut = gConfig.fanOut;
+    const scenario scenarios[] =
+    {
+        { "unit_task",                      test_unit_task,                     1,                  1 },
+        { "multiple_unit_tasks",            test_multiple_unit_tasks,           fanOut,             fanOut },
+        { "sequence_group",                 test_sequence_group,                fanOut,             1 },
+        { "parallel_group",                 test_parallel_group,                fanOut,             fanOut },
+        { "sequence_of_parallel_groups",    test_sequence_of_parallel_groups,   fanOut * fanOut,    fanOut },
+        { "parallel_for",                   test_parallel_for,                  fanOut,             fanOut },
+        { "parallel_for_task",              test_parallel_for_task,             fanOut,             fanOut },
+    };
+
+    setup_environment();
+    do
+    {
+        std::vector<scenario_result> results;
+        for (const auto &s : scenarios)
+        {
+            results.push_back(benchmark(s));
+        }
+        print_results(results);
+    } while (gConfig.loop);
     clean_up_environement();
-    getchar();
-}
\ No newline at end of file
+    return 0;
+}
@@ -3,78 +3,123 @@
 #include <atomic>
 #include <memory>
 #include <cassert>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
 #include "buffer_interface.hpp"
 
 
 // We use buffer_interface to provide some helpful generic accessors
 using ring_buffer = buffer_interface<class ring_buffer_impl>;
 
-// Thread safe single consumer, single producer, non overwriting ring buffer
+// Thread safe single consumer, single producer, non overwriting ring buffer.
+//
+// The capacity is a power of two and the cursors are free running 32-bit positions, masked on access.
+// The producer publishes with a release store of the write cursor that the consumer acquires, and
+// the other way around for the read cursor, each side keeping a cached copy of the other's cursor so
+// that the shared cache line is only touched when the cached value says the buffer is full (or empty).
+// Each cursor sits on its own cache line.
+//
+// reserve()/commit() and peek()/consume() give direct access to contiguous memory in the buffer, even
+// across the end of it: the first mirrorSize bytes of the buffer are mirrored right after its end.
+// Contiguous accesses are thus limited to maxContiguousSize() bytes.
 class ring_buffer_impl
 {
+    static constexpr size_t cache_line_size = 64;
+
     static void default_array_delete(uint8_t* ptr)
     {
         std::default_delete<uint8_t[]> defaultDeleter;
         defaultDeleter(ptr);
     }
 
-    // Small structure to keep track of the current index at which we can operate (read or write)
-    // and the number of time we looped over the buffer.
-    struct cursor_t
+    // Rounds up to a power of two
+    static uint32_t capacityFor(int32_t bufferSize)
     {
-        cursor_t(int32_t i = 0, int32_t lf = 0) : index(i), loopFlag(lf) {}
-        int32_t index;
-        int32_t loopFlag;
-    };
+        assert(bufferSize > 0);
+        uint32_t capacity = 1;
+        while (capacity < uint32_t(bufferSize))
+        {
+            capacity *= 2;
+        }
+        return capacity;
+    }
 
-    // Magic number to indicate that the data doesn't need to be sliced
-    enum { DO_NOT_SLICE = -1 };
+    static uint32_t mirrorSizeFor(uint32_t capacity)
+    {
+        return std::min(capacity, std::max(capacity / 16, 256u));
+    }
 
 protected:
+    // The capacity is bufferSize rounded up to a power of two
     ring_buffer_impl(int32_t bufferSize)
-        : buffer_(new uint8_t[bufferSize], &ring_buffer_impl::default_array_delete)
-        , bufferSize_(bufferSize)
-        , readCursor_(cursor_t(0, 0))
-        , writeCursor_(cursor_t(0, 0))
+        : ring_buffer_impl(capacityFor(bufferSize), mirrorSizeFor(capacityFor(bufferSize)))
     {}
 
+    // The buffer must hold a power of two capacity plus its mirror, i.e. bufferSize should be
+    // capacity + mirrorSizeFor(capacity). The largest capacity fitting in bufferSize is used.
     template<typename _Deleter>
     ring_buffer_impl(uint8_t* pBufferInit, int32_t bufferSize, _Deleter deleter)
         : buffer_(pBufferInit, deleter)
-        , bufferSize_(bufferSize)
-        , readCursor_(cursor_t(0, 0))
-        , writeCursor_(cursor_t(0, 0))
+        , capacity_(largestCapacityIn(bufferSize))
+        , mask_(capacity_ - 1)
+        , mirrorSize_(mirrorSizeFor(capacity_))
+        , writeCursor_(0)
+        , cachedReadCursor_(0)
+        , readCursor_(0)
+        , cachedWriteCursor_(0)
+    {}
+
+private:
+    ring_buffer_impl(uint32_t capacity, uint32_t mirrorSize)
+        : buffer_(new uint8_t[capacity + mirrorSize], &ring_buffer_impl::default_array_delete)
+        , capacity_(capacity)
+        , mask_(capacity - 1)
+        , mirrorSize_(mirrorSize)
+        , writeCursor_(0)
+        , cachedReadCursor_(0)
+        , readCursor_(0)
+        , cachedWriteCursor_(0)
     {}
 
+    static uint32_t largestCapacityIn(int32_t bufferSize)
+    {
+        uint32_t capacity = 1;
+        while (capacity * 2 + mirrorSizeFor(capacity * 2) <= uint32_t(bufferSize))
+        {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
 protected:
-    bool read(uint8_t *dst, int32_t size)
+    //----------------------------------------------------------------------------------------------
+    // Producer side
+
+    // Returns size contiguous bytes to write to, or nullptr if there isn't enough room.
+    // Nothing is visible to the consumer until commit() is called.
+    uint8_t* reserve(int32_t size)
     {
-        assert(dst != nullptr);
         assert(size > 0);
-
-        // Check if we have enough space to read the requested size
-        if (size <= readableSize())
+        if (uint32_t(size) > mirrorSize_ || !hasRoomFor(uint32_t(size)))
         {
-            // Does the available data loop back to the beginning of the buffer
-            const auto sliceAt = sliceRead(size);
-
-            // Determine whether we have to do 2 reads or not
-            const auto firstSliceSize = (sliceAt == DO_NOT_SLICE) ? size : sliceAt;
-            // In any case the first part always starts at readIndex()
-            std::memcpy(dst, buffer_.get() + readIndex(), firstSliceSize);
-
-            if (sliceAt != DO_NOT_SLICE)
-            {
-                // Read the last part, it's always located at the head of the buffer
-                const auto secondSliceSize = size - sliceAt;
-                std::memcpy(dst + sliceAt, buffer_.get(), secondSliceSize);
-            }
-
-            advanceReadIndex(size);
-            return true;
+            return nullptr;
         }
+        return buffer_.get() + (writeCursor_.load(std::memory_order_relaxed) & mask_);
+    }
 
-        return false;
+    // Publishes size bytes written at the address returned by the last reserve()
+    void commit(int32_t size)
+    {
+        const auto w = writeCursor_.load(std::memory_order_relaxed);
+        const auto start = w & mask_;
+        if (start + size > capacity_)
+        {
+            // Written past the end, in the mirror: the actual location is at the beginning
+            std::memcpy(buffer_.get(), buffer_.get() + capacity_, start + size - capacity_);
+        }
+        updateMirror(start, uint32_t(size));
+        writeCursor_.store(w + size, std::memory_order_release);
     }
 
     bool write(const uint8_t *src, int32_t size)
@@ -82,84 +127,136 @@ protected:
         assert(src != nullptr);
         assert(size > 0);
 
-        if (size <= writableSize())
+        if (!hasRoomFor(uint32_t(size)))
         {
-            const auto sliceAt = sliceWrite(size);
-
-            const auto firstSliceSize = (sliceAt == DO_NOT_SLICE) ? size : sliceAt;
-            std::memcpy(buffer_.get() + writeIndex(), src, firstSliceSize);
-
-            if (sliceAt != DO_NOT_SLICE)
-            {
-                const auto secondSliceSize = size - sliceAt;
-                std::memcpy(buffer_.get(), src + sliceAt, secondSliceSize);
-            }
+            return false;
+        }
 
-            advanceWriteIndex(size);
-            return true;
+        const auto w = writeCursor_.load(std::memory_order_relaxed);
+        const auto start = w & mask_;
+        const auto firstSliceSize = std::min(uint32_t(size), capacity_ - start);
+        std::memcpy(buffer_.get() + start, src, firstSliceSize);
+        if (firstSliceSize < uint32_t(size))
+        {
+            std::memcpy(buffer_.get(), src + firstSliceSize, size - firstSliceSize);
+            updateMirror(0, size - firstSliceSize);
         }
+        updateMirror(start, firstSliceSize);
 
-        return false;
+        writeCursor_.store(w + size, std::memory_order_release);
+        return true;
     }
 
-protected:
-    int32_t readIndex() const
+    //----------------------------------------------------------------------------------------------
+    // Consumer side
+
+    // Returns the size next contiguous bytes to read, or nullptr if they weren't all written yet.
+    // They stay in the buffer until consume() is called.
+    const uint8_t* peek(int32_t size)
     {
-        return readCursor_.load(std::memory_order_relaxed).index;
+        assert(size > 0);
+        if (uint32_t(size) > mirrorSize_ || !hasDataFor(uint32_t(size)))
+        {
+            return nullptr;
+        }
+        return buffer_.get() + (readCursor_.load(std::memory_order_relaxed) & mask_);
     }
 
-    int32_t writeIndex() const
+    // Releases the size bytes returned by the last peek()
+    void consume(int32_t size)
     {
-        return writeCursor_.load(std::memory_order_relaxed).index;
+        const auto r = readCursor_.load(std::memory_order_relaxed);
+        readCursor_.store(r + size, std::memory_order_release);
     }
 
-    int32_t readableSize() const
+    bool read(uint8_t *dst, int32_t size)
     {
+        assert(dst != nullptr);
+        assert(size > 0);
+
+        if (!hasDataFor(uint32_t(size)))
+        {
+            return false;
+        }
+
         const auto r = readCursor_.load(std::memory_order_relaxed);
-        const auto w = writeCursor_.load(std::memory_order_relaxed);
+        const auto start = r & mask_;
+        const auto firstSliceSize = std::min(uint32_t(size), capacity_ - start);
+        std::memcpy(dst, buffer_.get() + start, firstSliceSize);
+        if (firstSliceSize < uint32_t(size))
+        {
+            std::memcpy(dst + firstSliceSize, buffer_.get(), size - firstSliceSize);
+        }
 
-        const auto isFull = (r.index == w.index) && (r.loopFlag != w.loopFlag);
-        const auto normalizedWriteIndex = ((w.index < r.index) || isFull) ? (bufferSize_ + w.index) : w.index;
+        readCursor_.store(r + size, std::memory_order_release);
+        return true;
+    }
 
-        return normalizedWriteIndex - r.index;
+protected:
+    // Exact when called from the consumer, a lower bound from any other thread
+    int32_t readableSize() const
+    {
+        return int32_t(writeCursor_.load(std::memory_order_acquire) - readCursor_.load(std::memory_order_relaxed));
     }
 
+    // Exact when called from the producer, a lower bound from any other thread
     int32_t writableSize() const
     {
-        return bufferSize_ - readableSize();
+        return int32_t(capacity_ - (writeCursor_.load(std::memory_order_relaxed) - readCursor_.load(std::memory_order_acquire)));
     }
 
-    int32_t sliceRead(int32_t size) const
+    int32_t maxContiguousSize() const
     {
-        return ((readIndex() + size) > bufferSize_) ? bufferSize_ - readIndex() : DO_NOT_SLICE;
+        return int32_t(mirrorSize_);
     }
 
-    int32_t sliceWrite(int32_t size) const
+private:
+    bool hasRoomFor(uint32_t size)
     {
-        return ((writeIndex() + size) > bufferSize_) ? bufferSize_ - writeIndex() : DO_NOT_SLICE;
+        const auto w = writeCursor_.load(std::memory_order_relaxed);
+        if (capacity_ - (w - cachedReadCursor_) >= size)
+        {
+            return true;
+        }
+        cachedReadCursor_ = readCursor_.load(std::memory_order_acquire);
+        return capacity_ - (w - cachedReadCursor_) >= size;
     }
 
-    void advanceReadIndex(int32_t size)
+    bool hasDataFor(uint32_t size)
     {
         const auto r = readCursor_.load(std::memory_order_relaxed);
-        const auto newReadIndex = (r.index + size) % bufferSize_;
-        const auto newReadLoopFlag = (r.index + size) >= bufferSize_ ? (r.loopFlag ^ 1) : r.loopFlag;
-
-        readCursor_.store(cursor_t(newReadIndex, newReadLoopFlag), std::memory_order_relaxed);
+        if (cachedWriteCursor_ - r >= size)
+        {
+            return true;
+        }
+        cachedWriteCursor_ = writeCursor_.load(std::memory_order_acquire);
+        return cachedWriteCursor_ - r >= size;
     }
 
-    void advanceWriteIndex(int32_t size)
+    // Keeps the mirror in sync with the beginning of the buffer, for bytes written at [start, start + size)
+    void updateMirror(uint32_t start, uint32_t size)
     {
-        const auto w = writeCursor_.load(std::memory_order_relaxed);
-        const auto newWriteIndex = (w.index + size) % bufferSize_;
-        const auto newWriteLoopFlag = (w.index + size) >= bufferSize_ ? (w.loopFlag ^ 1) : w.loopFlag;
-
-        writeCursor_.store(cursor_t(newWriteIndex, newWriteLoopFlag), std::memory_order_relaxed);
+        if (start < mirrorSize_)
+        {
+            std::memcpy(buffer_.get() + capacity_ + start, buffer_.get() + start, std::min(size, mirrorSize_ - start));
+        }
     }
 
 private:
-    std::atomic<cursor_t>                           readCursor_;
-    std::atomic<cursor_t>                           writeCursor_;
+    // Read only after construction
     std::unique_ptr<uint8_t[], void(*)(uint8_t*)>   buffer_;
-    const int32_t                                   bufferSize_;
-};
\ No newline at end of file
+    const uint32_t                                  capacity_;
+    const uint32_t                                  mask_;
+    const uint32_t                                  mirrorSize_;
+    uint8_t                                         padding0_[cache_line_size];
+
+    // Written by the producer
+    std::atomic<uint32_t>                           writeCursor_;
+    uint32_t                                        cachedReadCursor_;
+    uint8_t                                         padding1_[cache_line_size - sizeof(uint32_t) * 2];
+
+    // Written by the consumer
+    std::atomic<uint32_t>                           readCursor_;
+    uint32_t                                        cachedWriteCursor_;
+    uint8_t                                         padding2_[cache_line_size - sizeof(uint32_t) * 2];
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include "oqpi.hpp"
+#include "telemetry_protocol.hpp"
+
+
+// Element last popped from a scheduled_queue by the calling thread
+struct dequeued_task
+{
+    oqpi::task_uid  uid         = oqpi::invalid_task_uid;
+    uint64_t        scheduledAt = not_scheduled;
+};
+
+inline dequeued_task& last_dequeued_task()
+{
+    static thread_local dequeued_task task;
+    return task;
+}
+
+
+// Adapter of the queue of oqpi::scheduler stamping every element with the time it was pushed.
+//
+// A worker executes what it pops right away, try_pop() thus leaves the uid and timestamp of the
+// element in last_dequeued_task(), where the timer contexts pick it up when the task starts: the
+// wait of a task in the queue is then its startedAt minus its scheduledAt. Only the contexts of
+// the task that was popped get the timestamp, a task executed without going through the queue
+// keeps not_scheduled.
+//
+// T must have getUID(), like oqpi::task_handle. _Clock must be the clock of the telemetry policy
+// of the contexts, both timestamps are compared. For instance, with a work stealing queue:
+//  template<typename T> using stealing_queue = work_stealing_queue<T, timer_steal_observer>;
+//  template<typename T> using queue = scheduled_queue<T, stealing_queue, telemetry_clock>;
+//  using scheduler_type = oqpi::scheduler<queue>;
+template<typename T, template<typename> class _Queue, typename _Clock>
+class scheduled_queue
+{
+    struct entry
+    {
+        T           item;
+        uint64_t    scheduledAt;
+    };
+
+public:
+    void push(T &&t)
+    {
+        queue_.push(entry{ std::move(t), _Clock::now() });
+    }
+
+    void push(const T &t)
+    {
+        queue_.push(entry{ t, _Clock::now() });
+    }
+
+    bool try_pop(T &v)
+    {
+        entry e;
+        if (!queue_.try_pop(e))
+        {
+            return false;
+        }
+
+        auto &dequeued = last_dequeued_task();
+        dequeued.uid            = e.item.getUID();
+        dequeued.scheduledAt    = e.scheduledAt;
+        v = std::move(e.item);
+        return true;
+    }
+
+    // Same guarantees as the adapted queue
+    bool empty() const
+    {
+        return queue_.empty();
+    }
+
+private:
+    _Queue<entry> queue_;
+};
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <new>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+#if defined(__linux__)
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <climits>
+#   include <ctime>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <sys/syscall.h>
+#   include <linux/futex.h>
+#   define OQPI_VISUALIZER_HAS_SHARED_MEMORY 1
+#else
+#   define OQPI_VISUALIZER_HAS_SHARED_MEMORY 0
+#endif
+
+
+//--------------------------------------------------------------------------------------------------
+// Byte stream between a client and a server running on the same machine, in a named shared memory
+// region. There is a single producer, the sender thread of the client, and a single consumer, the
+// session of the server.
+//
+// Both sides only touch memory as long as there is something to read: the producer makes a system
+// call only to ring the doorbell (a futex) when the consumer went to sleep on an empty ring, the
+// consumer only when it goes to sleep. The sessions of the server poll with a zero timeout: they
+// never sleep and the producer then makes no system call at all.
+//
+// The client creates the region and unlinks it as soon as the server mapped it, or refused to.
+// Only available on Linux, is_supported() returns false elsewhere and the client then keeps TCP.
+//--------------------------------------------------------------------------------------------------
+class shared_memory_ring
+{
+    static constexpr size_t     cache_line_size = 64;
+    static constexpr uint32_t   magic           = 0x4F515052; // OQPR
+    static constexpr uint32_t   version         = 1;
+
+    struct layout
+    {
+        std::atomic<uint32_t>   magic;          // Written last by the creator
+        uint32_t                version;
+        uint64_t                capacity;
+        uint8_t                 padding0[cache_line_size - 16];
+
+        std::atomic<uint64_t>   writeCursor;    // Producer
+        uint8_t                 padding1[cache_line_size - 8];
+
+        std::atomic<uint64_t>   readCursor;     // Consumer
+        std::atomic<uint32_t>   consumerAsleep;
+        std::atomic<uint32_t>   doorbell;       // Futex word, bumped to wake the consumer up
+        uint8_t                 padding2[cache_line_size - 16];
+    };
+
+    static_assert(sizeof(layout) == 3 * cache_line_size, "unexpected layout");
+    static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "cursors are shared between processes");
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "cursors are shared between processes");
+
+public:
+    static bool is_supported()
+    {
+        return OQPI_VISUALIZER_HAS_SHARED_MEMORY != 0;
+    }
+
+    // Longest name accepted by create() and open(), terminating zero excluded
+    static constexpr size_t max_name_length = 63;
+
+    // Creates a new region of the given capacity, rounded up to a power of two, throws on failure
+    static std::unique_ptr<shared_memory_ring> create(const std::string &name, uint64_t capacity)
+    {
+        uint64_t roundedCapacity = cache_line_size;
+        while (roundedCapacity < capacity)
+        {
+            roundedCapacity *= 2;
+        }
+
+        std::unique_ptr<shared_memory_ring> spRing(new shared_memory_ring(name));
+        spRing->map(true, sizeof(layout) + roundedCapacity);
+
+        auto pLayout = new (spRing->pLayout_) layout();
+        pLayout->version    = version;
+        pLayout->capacity   = roundedCapacity;
+        pLayout->writeCursor.store(0, std::memory_order_relaxed);
+        pLayout->readCursor.store(0, std::memory_order_relaxed);
+        pLayout->consumerAsleep.store(0, std::memory_order_relaxed);
+        pLayout->doorbell.store(0, std::memory_order_relaxed);
+        pLayout->magic.store(magic, std::memory_order_release);
+        spRing->mask_ = roundedCapacity - 1;
+        return spRing;
+    }
+
+    // Maps a region created by another process, throws on failure
+    static std::unique_ptr<shared_memory_ring> open(const std::string &name)
+    {
+        std::unique_ptr<shared_memory_ring> spRing(new shared_memory_ring(name));
+        spRing->map(false, 0);
+        spRing->mask_ = spRing->pLayout_->capacity - 1;
+        return spRing;
+    }
+
+    ~shared_memory_ring()
+    {
+#if OQPI_VISUALIZER_HAS_SHARED_MEMORY
+        if (pLayout_)
+        {
+            munmap(pLayout_, mappedSize_);
+        }
+#endif
+    }
+
+    shared_memory_ring(const shared_memory_ring &) = delete;
+    shared_memory_ring& operator=(const shared_memory_ring &) = delete;
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+    // Largest write() that can succeed
+    uint64_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+    // Removes the name, the mappings stay valid
+    void unlink()
+    {
+#if OQPI_VISUALIZER_HAS_SHARED_MEMORY
+        shm_unlink(name_.c_str());
+#endif
+    }
+
+    //----------------------------------------------------------------------------------------------
+    // Producer side
+
+    // Writes all of src or nothing, the consumer never sees part of it. Waits for room as long as the
+    // consumer makes progress, returns false if it stopped reading for longer than the timeout, or
+    // right away if size is larger than the capacity.
+    bool write(const uint8_t *src, size_t size, std::chrono::milliseconds timeout = std::chrono::seconds(5))
+    {
+        const auto capacity = mask_ + 1;
+        if (size > capacity)
+        {
+            return false;
+        }
+
+        const auto w = pLayout_->writeCursor.load(std::memory_order_relaxed);
+        auto r = pLayout_->readCursor.load(std::memory_order_acquire);
+        auto lastProgress = std::chrono::steady_clock::now();
+        while (capacity - (w - r) < size)
+        {
+            if (std::chrono::steady_clock::now() - lastProgress > timeout)
+            {
+                return false;
+            }
+            std::this_thread::yield();
+
+            const auto previousR = r;
+            r = pLayout_->readCursor.load(std::memory_order_acquire);
+            if (r != previousR)
+            {
+                lastProgress = std::chrono::steady_clock::now();
+            }
+        }
+
+        copyIn(w, src, size);
+        publish(w + size);
+        return true;
+    }
+
+    //----------------------------------------------------------------------------------------------
+    // Consumer side
+
+    // Reads at most maxSize bytes, sleeps up to timeout when the ring is empty, never with a zero
+    // timeout. Returns the number of bytes read, 0 if the ring stayed empty, throws if the producer
+    // corrupted the cursors.
+    size_t read(uint8_t *dst, size_t maxSize, std::chrono::milliseconds timeout)
+    {
+        if (readableSize() == 0 && timeout.count() > 0)
+        {
+            sleep(timeout);
+        }
+
+        // The cursors are in memory the producer's process can write anything to: more than the
+        // capacity to read means the stream is corrupted, and nothing is ever read past the mapping
+        const auto r = pLayout_->readCursor.load(std::memory_order_relaxed);
+        const auto available = pLayout_->writeCursor.load(std::memory_order_acquire) - r;
+        if (available > mask_ + 1)
+        {
+            throw std::runtime_error("corrupted shared memory " + name_);
+        }
+
+        const auto size = std::min<uint64_t>(available, maxSize);
+        if (size > 0)
+        {
+            copyOut(dst, r, size);
+            pLayout_->readCursor.store(r + size, std::memory_order_release);
+        }
+        return size_t(size);
+    }
+
+    // Rings the doorbell, read() returns early if it was sleeping
+    void wake()
+    {
+        pLayout_->doorbell.fetch_add(1, std::memory_order_seq_cst);
+#if OQPI_VISUALIZER_HAS_SHARED_MEMORY
+        // Not FUTEX_PRIVATE_FLAG: the waiter is in another process
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&pLayout_->doorbell), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+    }
+
+    uint64_t readableSize() const
+    {
+        return pLayout_->writeCursor.load(std::memory_order_acquire) - pLayout_->readCursor.load(std::memory_order_relaxed);
+    }
+
+private:
+    explicit shared_memory_ring(const std::string &name)
+        : name_(name)
+        , pLayout_(nullptr)
+        , pData_(nullptr)
+        , mappedSize_(0)
+        , mask_(0)
+    {
+        if (name_.size() > max_name_length || name_.empty() || name_[0] != '/')
+        {
+            throw std::runtime_error("invalid shared memory name " + name_);
+        }
+    }
+
+    void map(bool create, uint64_t size)
+    {
+#if OQPI_VISUALIZER_HAS_SHARED_MEMORY
+        const auto fd = shm_open(name_.c_str(), create ? (O_CREAT | O_EXCL | O_RDWR) : O_RDWR, 0600);
+        if (fd < 0)
+        {
+            throw std::runtime_error("cannot open shared memory " + name_ + ": " + strerror(errno));
+        }
+
+        struct stat st;
+        const auto sized = create ? (ftruncate(fd, off_t(size)) == 0) : (fstat(fd, &st) == 0);
+        if (!create)
+        {
+            size = uint64_t(st.st_size);
+        }
+        auto pMapping = sized && size > sizeof(layout)
+            ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+            : MAP_FAILED;
+        close(fd);
+        if (pMapping == MAP_FAILED)
+        {
+            if (create)
+            {
+                shm_unlink(name_.c_str());
+            }
+            throw std::runtime_error("cannot map shared memory " + name_);
+        }
+
+        pLayout_    = static_cast<layout*>(pMapping);
+        pData_      = static_cast<uint8_t*>(pMapping) + sizeof(layout);
+        mappedSize_ = size;
+
+        // Whoever opens the region must find what the creator wrote
+        if (!create)
+        {
+            const auto capacity = pLayout_->capacity;
+            if (pLayout_->magic.load(std::memory_order_acquire) != magic || pLayout_->version != version
+                || capacity == 0 || (capacity & (capacity - 1)) != 0 || sizeof(layout) + capacity != size)
+            {
+                throw std::runtime_error("invalid shared memory " + name_);
+            }
+        }
+#else
+        (void)create;
+        (void)size;
+        throw std::runtime_error("shared memory is not supported on this platform");
+#endif
+    }
+
+    void copyIn(uint64_t cursor, const uint8_t *src, uint64_t size)
+    {
+        const auto start = cursor & mask_;
+        const auto firstSliceSize = std::min(size, mask_ + 1 - start);
+        memcpy(pData_ + start, src, size_t(firstSliceSize));
+        memcpy(pData_, src + firstSliceSize, size_t(size - firstSliceSize));
+    }
+
+    void copyOut(uint8_t *dst, uint64_t cursor, uint64_t size) const
+    {
+        const auto start = cursor & mask_;
+        const auto firstSliceSize = std::min(size, mask_ + 1 - start);
+        memcpy(dst, pData_ + start, size_t(firstSliceSize));
+        memcpy(dst + firstSliceSize, pData_, size_t(size - firstSliceSize));
+    }
+
+    // The consumer announces it is asleep before checking the ring one last time, the producer
+    // publishes before checking whether it is asleep: one of them always sees the other.
+    void publish(uint64_t writeCursor)
+    {
+        pLayout_->writeCursor.store(writeCursor, std::memory_order_seq_cst);
+        if (pLayout_->consumerAsleep.load(std::memory_order_seq_cst) != 0)
+        {
+            wake();
+        }
+    }
+
+    void sleep(std::chrono::milliseconds timeout)
+    {
+        const auto ring = pLayout_->doorbell.load(std::memory_order_seq_cst);
+        pLayout_->consumerAsleep.store(1, std::memory_order_seq_cst);
+        if (pLayout_->writeCursor.load(std::memory_order_seq_cst) == pLayout_->readCursor.load(std::memory_order_relaxed))
+        {
+            waitForDoorbell(ring, timeout);
+        }
+        pLayout_->consumerAsleep.store(0, std::memory_order_relaxed);
+    }
+
+    void waitForDoorbell(uint32_t ring, std::chrono::milliseconds timeout)
+    {
+#if OQPI_VISUALIZER_HAS_SHARED_MEMORY
+        timespec ts;
+        ts.tv_sec   = time_t(timeout.count() / 1000);
+        ts.tv_nsec  = long(timeout.count() % 1000) * 1000000;
+        // Returns right away if the doorbell rang since we read it
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&pLayout_->doorbell), FUTEX_WAIT, ring, &ts, nullptr, 0);
+#else
+        (void)ring;
+        std::this_thread::sleep_for(timeout);
+#endif
+    }
+
+
+private:
+    const std::string   name_;
+    layout              *pLayout_;
+    uint8_t             *pData_;
+    uint64_t            mappedSize_;
+    // Copied when the region is created or opened, the other process may overwrite its capacity
+    uint64_t            mask_;
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include "telemetry_protocol.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Compact encoding of a batch of task_info records, the payload of end_task_packed frames.
+//
+// The records are transposed into columns, each column is written after the other:
+//  - uid, groupUID, nameId, startedAt: difference with the previous record, zigzag varint
+//  - stoppedAt:                        duration of the task, zigzag varint
+//  - scheduledAt:                      0 when not_scheduled, otherwise 1 + wait of the task in the
+//                                      queue, zigzag varint
+//  - startedOnThread:                  runs of (value varint, length varint)
+//  - stoppedOnThread:                  runs of the xor with startedOnThread, mostly one run of 0
+//  - startedOnCore, stoppedOnCore:     runs of (value varint, length varint), the value taking at
+//                                      most 2 bytes
+//  - priority:                         runs of (value varint, length varint), as for cores
+// Records are drained a staging buffer at a time, neighbors thus mostly come from the same thread
+// and follow each other closely, which is what makes the differences small and the runs long.
+//
+// An instance keeps its scratch memory from a batch to the next, it is meant to be reused.
+//--------------------------------------------------------------------------------------------------
+class task_column_codec
+{
+public:
+    // Smallest encoded record, any batch announcing more records than that allows is corrupted
+    static constexpr size_t min_record_size = 6;
+    // Largest one: 10 bytes per 64-bit varint, 5 per run length, 2 per core and priority
+    static constexpr size_t max_record_size = 6 * 10 + 2 * (10 + 5) + 3 * (2 + 5);
+
+    // Appends the encoding of count records, stored contiguously as in end_task frames, to out
+    void encode(const uint8_t *records, uint32_t count, std::vector<uint8_t> &out)
+    {
+        tasks_.resize(count);
+        memcpy(tasks_.data(), records, count * sizeof(task_info));
+
+        const auto offset = out.size();
+        out.resize(offset + count * max_record_size);
+        auto p = out.data() + offset;
+
+        p = encodeDeltas(p, [](const task_info &ti) { return ti.uid; });
+        p = encodeDeltas(p, [](const task_info &ti) { return ti.groupUID; });
+        p = encodeDeltas(p, [](const task_info &ti) { return uint64_t(ti.nameId); });
+        p = encodeDeltas(p, [](const task_info &ti) { return ti.startedAt; });
+        for (const auto &ti : tasks_)
+        {
+            p = writeVarint(p, zigzag(int64_t(ti.stoppedAt - ti.startedAt)));
+        }
+        for (const auto &ti : tasks_)
+        {
+            p = writeVarint(p, ti.scheduledAt == not_scheduled ? 0 : zigzag(int64_t(ti.startedAt - ti.scheduledAt)) + 1);
+        }
+        p = encodeRuns(p, [](const task_info &ti) { return uint64_t(ti.startedOnThread); });
+        p = encodeRuns(p, [](const task_info &ti) { return uint64_t(ti.stoppedOnThread ^ ti.startedOnThread); });
+        p = encodeRuns(p, [](const task_info &ti) { return uint64_t(ti.startedOnCore); });
+        p = encodeRuns(p, [](const task_info &ti) { return uint64_t(ti.stoppedOnCore); });
+        p = encodeRuns(p, [](const task_info &ti) { return uint64_t(ti.priority); });
+
+        out.resize(size_t(p - out.data()));
+    }
+
+    // Decodes count records from data, calls onTask(const task_info &) for each of them.
+    // Returns the number of bytes read, throws if they don't make count valid records.
+    template<typename _OnTask>
+    size_t decode(const uint8_t *data, size_t size, uint32_t count, _OnTask &&onTask)
+    {
+        if (count > size / min_record_size)
+        {
+            throw std::runtime_error("malformed packed tasks");
+        }
+
+        tasks_.assign(count, task_info());
+        const auto end = data + size;
+        auto p = data;
+
+        p = decodeDeltas(p, end, [](task_info &ti, uint64_t v) { ti.uid = v; });
+        p = decodeDeltas(p, end, [](task_info &ti, uint64_t v) { ti.groupUID = v; });
+        p = decodeDeltas(p, end, [](task_info &ti, uint64_t v) { ti.nameId = uint32_t(v); });
+        p = decodeDeltas(p, end, [](task_info &ti, uint64_t v) { ti.startedAt = v; });
+        for (auto &ti : tasks_)
+        {
+            uint64_t duration = 0;
+            p = readVarint(p, end, duration);
+            ti.stoppedAt = ti.startedAt + uint64_t(unzigzag(duration));
+        }
+        for (auto &ti : tasks_)
+        {
+            uint64_t wait = 0;
+            p = readVarint(p, end, wait);
+            ti.scheduledAt = wait == 0 ? not_scheduled : ti.startedAt - uint64_t(unzigzag(wait - 1));
+        }
+        p = decodeRuns(p, end, [](task_info &ti, uint64_t v) { ti.startedOnThread = task_info::thread_id(v); });
+        p = decodeRuns(p, end, [](task_info &ti, uint64_t v) { ti.stoppedOnThread = task_info::thread_id(v) ^ ti.startedOnThread; });
+        p = decodeRuns(p, end, [](task_info &ti, uint64_t v) { ti.startedOnCore = uint8_t(v); });
+        p = decodeRuns(p, end, [](task_info &ti, uint64_t v) { ti.stoppedOnCore = uint8_t(v); });
+        p = decodeRuns(p, end, [](task_info &ti, uint64_t v) { ti.priority = uint8_t(v); });
+
+        for (const auto &ti : tasks_)
+        {
+            onTask(ti);
+        }
+        return size_t(p - data);
+    }
+
+private:
+    static uint64_t zigzag(int64_t v)
+    {
+        return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+    }
+
+    static int64_t unzigzag(uint64_t v)
+    {
+        return int64_t(v >> 1) ^ -int64_t(v & 1);
+    }
+
+    static uint8_t* writeVarint(uint8_t *p, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            *p++ = uint8_t(v) | 0x80;
+            v >>= 7;
+        }
+        *p++ = uint8_t(v);
+        return p;
+    }
+
+    static const uint8_t* readVarint(const uint8_t *p, const uint8_t *end, uint64_t &v)
+    {
+        v = 0;
+        for (uint32_t shift = 0; shift < 64; shift += 7)
+        {
+            if (p == end)
+            {
+                break;
+            }
+            const auto byte = *p++;
+            v |= uint64_t(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return p;
+            }
+        }
+        throw std::runtime_error("malformed packed tasks");
+    }
+
+    template<typename _Get>
+    uint8_t* encodeDeltas(uint8_t *p, _Get &&get) const
+    {
+        uint64_t previous = 0;
+        for (const auto &ti : tasks_)
+        {
+            const auto v = get(ti);
+            p = writeVarint(p, zigzag(int64_t(v - previous)));
+            previous = v;
+        }
+        return p;
+    }
+
+    template<typename _Set>
+    const uint8_t* decodeDeltas(const uint8_t *p, const uint8_t *end, _Set &&set)
+    {
+        uint64_t previous = 0;
+        for (auto &ti : tasks_)
+        {
+            uint64_t delta = 0;
+            p = readVarint(p, end, delta);
+            previous += uint64_t(unzigzag(delta));
+            set(ti, previous);
+        }
+        return p;
+    }
+
+    template<typename _Get>
+    uint8_t* encodeRuns(uint8_t *p, _Get &&get) const
+    {
+        for (size_t i = 0; i < tasks_.size();)
+        {
+            const auto v = get(tasks_[i]);
+            size_t length = 1;
+            while (i + length < tasks_.size() && get(tasks_[i + length]) == v)
+            {
+                ++length;
+            }
+            p = writeVarint(p, v);
+            p = writeVarint(p, length);
+            i += length;
+        }
+        return p;
+    }
+
+    template<typename _Set>
+    const uint8_t* decodeRuns(const uint8_t *p, const uint8_t *end, _Set &&set)
+    {
+        for (size_t i = 0; i < tasks_.size();)
+        {
+            uint64_t v = 0, length = 0;
+            p = readVarint(p, end, v);
+            p = readVarint(p, end, length);
+            if (length == 0 || length > tasks_.size() - i)
+            {
+                throw std::runtime_error("malformed packed tasks");
+            }
+            for (const auto last = i + size_t(length); i < last; ++i)
+            {
+                set(tasks_[i], v);
+            }
+        }
+        return p;
+    }
+
+private:
+    std::vector<task_info> tasks_;
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include "telemetry_protocol.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Keeps track of the parent of each group and interns the paths they form.
+// A path is a (parent path, name) pair identified by a 32-bit id, so a task path costs one lookup
+// whatever its depth. Groups memoize the id of their own path the first time it is needed, as long
+// as their whole chain of parents is known at that point.
+class task_hierarchy
+{
+public:
+    // Path of the root, i.e. the parent path of top level tasks
+    static constexpr uint32_t root_path_id  = 0xFFFFFFFF;
+    // Guards against corrupted streams linking groups in a loop
+    static constexpr size_t   max_depth     = 256;
+
+public:
+    void addGroup(const group_info &gi)
+    {
+        auto &group = groups_[gi.uid];
+        if (group.parentUID != gi.groupUID || group.nameId != gi.nameId)
+        {
+            group.parentUID = gi.groupUID;
+            group.nameId    = gi.nameId;
+            group.pathId    = root_path_id;
+        }
+    }
+
+    void removeGroup(oqpi::task_uid uid)
+    {
+        groups_.erase(uid);
+    }
+
+    // Path of a task with the given name belonging to the given group
+    uint32_t taskPath(oqpi::task_uid groupUID, uint32_t nameId)
+    {
+        return internPath(groupPath(groupUID), nameId);
+    }
+
+    // Path of the given group itself, root_path_id for invalid_task_uid
+    uint32_t groupPath(oqpi::task_uid uid)
+    {
+        if (uid == oqpi::invalid_task_uid)
+        {
+            return root_path_id;
+        }
+
+        // Walk up until we find a group whose path is already known, or the root
+        auto basePath = root_path_id;
+        auto complete = true;
+        chain_.clear();
+        for (auto it = groups_.find(uid);; it = groups_.find(it->second.parentUID))
+        {
+            if (it == groups_.end())
+            {
+                // Unknown ancestor, the path is resolved as if it was the root but not memoized
+                complete = false;
+                break;
+            }
+
+            auto &group = it->second;
+            if (group.pathId != root_path_id)
+            {
+                basePath = group.pathId;
+                break;
+            }
+
+            chain_.push_back(&group);
+            if (group.parentUID == oqpi::invalid_task_uid)
+            {
+                break;
+            }
+            if (chain_.size() >= max_depth)
+            {
+                complete = false;
+                break;
+            }
+        }
+
+        // Then build the paths back down to the requested group
+        for (auto i = chain_.size(); i-- > 0;)
+        {
+            basePath = internPath(basePath, chain_[i]->nameId);
+            if (complete)
+            {
+                chain_[i]->pathId = basePath;
+            }
+        }
+
+        return basePath;
+    }
+
+    uint32_t parentPath(uint32_t pathId) const
+    {
+        return pathId < paths_.size() ? paths_[pathId].parentPathId : root_path_id;
+    }
+
+    uint32_t pathNameId(uint32_t pathId) const
+    {
+        return pathId < paths_.size() ? paths_[pathId].nameId : invalid_name_id;
+    }
+
+    // Builds the full "group/.../name" string, meant for reporting only
+    template<typename _GetName>
+    std::string pathName(uint32_t pathId, _GetName &&getName) const
+    {
+        std::vector<uint32_t> nameIds;
+        for (; pathId < paths_.size() && nameIds.size() < max_depth; pathId = paths_[pathId].parentPathId)
+        {
+            nameIds.push_back(paths_[pathId].nameId);
+        }
+
+        std::string fullName;
+        for (auto i = nameIds.size(); i-- > 0;)
+        {
+            fullName += getName(nameIds[i]);
+            if (i > 0)
+            {
+                fullName += "/";
+            }
+        }
+        return fullName;
+    }
+
+    size_t pathCount() const
+    {
+        return paths_.size();
+    }
+
+private:
+    uint32_t internPath(uint32_t parentPathId, uint32_t nameId)
+    {
+        const auto key = (uint64_t(parentPathId) << 32) | nameId;
+        const auto it = pathIds_.find(key);
+        if (it != pathIds_.end())
+        {
+            return it->second;
+        }
+
+        const auto pathId = uint32_t(paths_.size());
+        paths_.push_back(path_node{ parentPathId, nameId });
+        pathIds_.emplace(key, pathId);
+        return pathId;
+    }
+
+private:
+    struct group_node
+    {
+        oqpi::task_uid  parentUID   = oqpi::invalid_task_uid;
+        uint32_t        nameId      = invalid_name_id;
+        uint32_t        pathId      = root_path_id;
+    };
+
+    struct path_node
+    {
+        uint32_t parentPathId;
+        uint32_t nameId;
+    };
+
+private:
+    std::unordered_map<oqpi::task_uid, group_node>  groups_;
+    std::vector<path_node>                          paths_;
+    std::unordered_map<uint64_t, uint32_t>          pathIds_;
+    std::vector<group_node*>                        chain_;
+};
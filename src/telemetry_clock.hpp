@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <thread>
+
+#if defined(_WIN32)
+#   include <windows.h>
+#   include <intrin.h>
+#else
+#   include <time.h>
+#   if defined(__x86_64__) || defined(__i386__)
+#       include <x86intrin.h>
+#       include <cpuid.h>
+#   endif
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#   define OQPI_VISUALIZER_HAS_TSC 1
+#else
+#   define OQPI_VISUALIZER_HAS_TSC 0
+#endif
+
+
+//--------------------------------------------------------------------------------------------------
+// Clocks used to timestamp tasks.
+// A clock exposes now() returning 64-bit ticks and ticks_per_second(). The conversion to actual
+// time units is left to whoever reads the timestamps (i.e. the server), the client only sends the
+// frequency once.
+//--------------------------------------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------------------------------------
+// Monotonic clock of the OS: QueryPerformanceCounter on Windows, CLOCK_MONOTONIC_RAW elsewhere
+struct os_clock
+{
+    static uint64_t now()
+    {
+#if defined(_WIN32)
+        LARGE_INTEGER li;
+        QueryPerformanceCounter(&li);
+        return uint64_t(li.QuadPart);
+#else
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+#endif
+    }
+
+    static uint64_t ticks_per_second()
+    {
+#if defined(_WIN32)
+        static const auto frequency = []
+        {
+            LARGE_INTEGER li;
+            QueryPerformanceFrequency(&li);
+            return uint64_t(li.QuadPart);
+        }();
+        return frequency;
+#else
+        return 1000000000ull;
+#endif
+    }
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Time stamp counter of the CPU, only reliable when it is invariant (constant rate and synchronized
+// across cores) which is_available() checks. Its frequency is calibrated against os_clock.
+struct tsc_clock
+{
+    static bool is_available()
+    {
+#if OQPI_VISUALIZER_HAS_TSC
+        // CPUID.80000007H:EDX[8] is the invariant TSC flag
+        uint32_t regs[4] = {};
+        cpuid(0x80000000, regs);
+        if (regs[0] < 0x80000007)
+        {
+            return false;
+        }
+        cpuid(0x80000007, regs);
+        return (regs[3] & (1u << 8)) != 0;
+#else
+        return false;
+#endif
+    }
+
+    static uint64_t now()
+    {
+#if OQPI_VISUALIZER_HAS_TSC
+        unsigned int aux;
+        return __rdtscp(&aux);
+#else
+        return os_clock::now();
+#endif
+    }
+
+    static uint64_t ticks_per_second()
+    {
+        static const auto frequency = calibrate();
+        return frequency;
+    }
+
+private:
+    static uint64_t calibrate()
+    {
+#if OQPI_VISUALIZER_HAS_TSC
+        // Measure both clocks over the same interval, taking the smallest os_clock reading window
+        // around each TSC read to limit the noise of being preempted in between.
+        const auto sample = [](uint64_t &tsc, uint64_t &os)
+        {
+            auto best = UINT64_MAX;
+            for (int i = 0; i < 16; ++i)
+            {
+                const auto os0 = os_clock::now();
+                const auto t   = now();
+                const auto os1 = os_clock::now();
+                if (os1 - os0 < best)
+                {
+                    best    = os1 - os0;
+                    tsc     = t;
+                    os      = os0 + (os1 - os0) / 2;
+                }
+            }
+        };
+
+        uint64_t tsc0 = 0, os0 = 0, tsc1 = 0, os1 = 0;
+        sample(tsc0, os0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        sample(tsc1, os1);
+
+        const auto osElapsed = double(os1 - os0) / double(os_clock::ticks_per_second());
+        return uint64_t(double(tsc1 - tsc0) / osElapsed);
+#else
+        return os_clock::ticks_per_second();
+#endif
+    }
+
+#if OQPI_VISUALIZER_HAS_TSC
+    static void cpuid(uint32_t leaf, uint32_t (&regs)[4])
+    {
+#   if defined(_MSC_VER)
+        __cpuid((int*)regs, int(leaf));
+#   else
+        __cpuid(leaf, regs[0], regs[1], regs[2], regs[3]);
+#   endif
+    }
+#endif
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Uses the TSC when it can be trusted, the OS clock otherwise
+struct default_clock
+{
+    static uint64_t now()
+    {
+        return use_tsc() ? tsc_clock::now() : os_clock::now();
+    }
+
+    static uint64_t ticks_per_second()
+    {
+        return use_tsc() ? tsc_clock::ticks_per_second() : os_clock::ticks_per_second();
+    }
+
+private:
+    static bool use_tsc()
+    {
+        static const auto useTsc = tsc_clock::is_available();
+        return useTsc;
+    }
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// The clock can be replaced by defining OQPI_VISUALIZER_CLOCK to any type exposing the same interface
+#ifndef OQPI_VISUALIZER_CLOCK
+#   define OQPI_VISUALIZER_CLOCK default_clock
+#endif
+using telemetry_clock = OQPI_VISUALIZER_CLOCK;
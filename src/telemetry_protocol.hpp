@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include "oqpi.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Wire format shared by visualizer_client and visualizer_server.
+//
+// The stream is a sequence of frames, each frame being a frame_header followed by recordCount
+// records of the kind given by its opcode:
+//  - register_task: name_record, followed by the characters of the name
+//  - add_to_group:  group_info, sent when a group is created and when it is added to a parent group
+//  - end_task:      task_info
+//  - clock_info:    clock_record, always the first frame of a connection
+//  - steal_task:    steal_info, sent by work stealing schedulers
+//  - attach_shared_memory: shared_memory_record, see below
+//  - end_task_packed: task_info records, transposed and compressed by task_column_codec
+//  - dropped_records: dropped_info, sent when records were lost on the client's side
+// Names are sent once per connection, task_info only refers to their id. The client always sends
+// the registration of a name before any record using it, and sends the pending group_info records
+// before the task_info records flushed at the same time.
+//
+// A client connected to a local server can move the stream to shared memory: right after
+// connecting, it sends a single attach_shared_memory frame and waits for a byte from the server,
+// 1 if the server mapped the region, 0 otherwise. From then on, frames go through the region when
+// it was accepted, through the socket otherwise. The socket stays open for the whole session.
+//--------------------------------------------------------------------------------------------------
+enum opcode : uint8_t
+{
+    register_task,
+    unregister_task,
+    add_to_group,
+    start_task,
+    end_task,
+    clock_info,
+    steal_task,
+    attach_shared_memory,
+    end_task_packed,
+    dropped_records,
+
+    count
+};
+
+static constexpr uint32_t invalid_name_id = 0xFFFFFFFF;
+
+// Name ids are dense, anything above that is considered a corrupted stream
+static constexpr uint32_t max_name_count = 1u << 20;
+
+// Cores and threads are left to these values when the client doesn't capture them
+static constexpr uint8_t unknown_core = 0xFF;
+static constexpr uint64_t unknown_thread = 0;
+static constexpr uint8_t unknown_priority = 0xFF;
+
+// scheduledAt of the tasks that did not wait in the queue of a scheduler: the scheduler doesn't use
+// a scheduled_queue, or the task was executed directly, e.g. by the sequence group it belongs to
+static constexpr uint64_t not_scheduled = 0;
+
+struct name_record
+{
+    uint32_t    nameId  = invalid_name_id;
+    uint16_t    length  = 0;
+};
+
+// Timestamps are raw ticks of the client's clock, this gives the server what it needs to convert them
+struct clock_record
+{
+    uint64_t    ticksPerSecond  = 0;
+};
+
+// Exact for any 64-bit number of ticks
+inline uint64_t ticks_to_nanoseconds(uint64_t ticks, uint64_t ticksPerSecond)
+{
+    const auto seconds = ticks / ticksPerSecond;
+    const auto remainder = ticks % ticksPerSecond;
+    return seconds * 1000000000ull + (remainder * 1000000000ull) / ticksPerSecond;
+}
+
+struct group_info
+{
+    oqpi::task_uid  uid         = oqpi::invalid_task_uid;
+    oqpi::task_uid  groupUID    = oqpi::invalid_task_uid;
+    uint32_t        nameId      = invalid_name_id;
+    uint32_t        padding     = 0;
+};
+
+struct task_info
+{
+    using thread_id = oqpi::thread_interface<>::id;
+
+    oqpi::task_uid  uid             = oqpi::invalid_task_uid;
+    oqpi::task_uid  groupUID        = oqpi::invalid_task_uid;
+    uint64_t        scheduledAt     = not_scheduled;    // Pushed to the queue of the scheduler
+    uint64_t        startedAt       = 0;
+    uint64_t        stoppedAt       = 0;
+    thread_id       startedOnThread = unknown_thread;
+    thread_id       stoppedOnThread = unknown_thread;
+    uint32_t        nameId          = invalid_name_id;
+    uint8_t         startedOnCore   = unknown_core;
+    uint8_t         stoppedOnCore   = unknown_core;
+    uint8_t         priority        = unknown_priority; // oqpi::task_priority
+    uint8_t         padding         = 0;
+};
+
+// A worker took a task queued by another one
+struct steal_info
+{
+    using thread_id = oqpi::thread_interface<>::id;
+
+    uint64_t        stolenAt    = 0;
+    thread_id       thief       = 0;
+    thread_id       victim      = 0;
+    uint8_t         thiefCore   = unknown_core;
+    uint8_t         padding[7]  = {};
+};
+
+// Records the client dropped since its previous dropped_info because its staging buffers were full
+struct dropped_info
+{
+    uint64_t        count       = 0;
+};
+
+// Region created by the client, see shared_memory_ring
+struct shared_memory_record
+{
+    char        name[64]    = {};   // Zero terminated
+};
+
+struct frame_header
+{
+    uint32_t    size        = 0;    // Size of the whole frame in bytes, header included
+    uint32_t    recordCount = 0;
+    opcode      op          = opcode::count;
+    uint8_t     padding[7]  = {};   // Keeps the records 8-byte aligned
+};
+
+// Upper bound of a frame, anything bigger is considered a corrupted stream
+static constexpr uint32_t max_frame_size = 16 * 1024 * 1024;
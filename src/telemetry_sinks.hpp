@@ -0,0 +1,206 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "oqpi.hpp"
+#include "telemetry_clock.hpp"
+#include "telemetry_protocol.hpp"
+#include "visualizer_client.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Destinations of the records of the timer contexts.
+// A sink exposes, as static functions:
+//  - register_name(name) returning the id the records use to refer to the name
+//  - send(record) for task_info, group_info and steal_info records
+//  - use_shared_staging_buffer(), a hint for threads that emit few records
+//--------------------------------------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------------------------------------
+// Connection to the telemetry server, one per clock: the server converts the timestamps of a
+// connection with the frequency of its clock.
+template<typename _Clock>
+class basic_timing_registry
+{
+public:
+
+    basic_timing_registry()
+        : client_(clientConfig())
+    {}
+
+    static basic_timing_registry& get()
+    {
+        static basic_timing_registry instance;
+        return instance;
+    }
+
+    uint32_t registerName(const std::string &name)
+    {
+        return client_.registerName(name);
+    }
+
+    // For threads that are not oqpi workers and emit few records, see visualizer_client
+    void useSharedStagingBuffer()
+    {
+        client_.useSharedStagingBuffer();
+    }
+
+    bool usesSharedMemory() const
+    {
+        return client_.usesSharedMemory();
+    }
+
+    // Only stages the record in the calling thread's buffer, see visualizer_client
+    void send(const task_info &ti)
+    {
+        client_.encodeAndSend(opcode::end_task, ti);
+    }
+
+    void send(const group_info &gi)
+    {
+        client_.encodeAndSend(opcode::add_to_group, gi);
+    }
+
+    void send(const steal_info &si)
+    {
+        client_.encodeAndSend(opcode::steal_task, si);
+    }
+
+private:
+    static visualizer_client::config clientConfig()
+    {
+        visualizer_client::config cfg;
+        cfg.ticksPerSecond = _Clock::ticks_per_second();
+        return cfg;
+    }
+
+private:
+    visualizer_client client_;
+};
+
+using timing_registry = basic_timing_registry<telemetry_clock>;
+
+
+//--------------------------------------------------------------------------------------------------
+// Sends the records to the telemetry server
+template<typename _Clock>
+struct network_sink
+{
+    static uint32_t register_name(const std::string &name)
+    {
+        return basic_timing_registry<_Clock>::get().registerName(name);
+    }
+
+    template<typename _Record>
+    static void send(const _Record &record)
+    {
+        basic_timing_registry<_Clock>::get().send(record);
+    }
+
+    static void use_shared_staging_buffer()
+    {
+        basic_timing_registry<_Clock>::get().useSharedStagingBuffer();
+    }
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Keeps the records in the process, for tests and tools analyzing a run by themselves.
+// Every record takes a lock: it is meant for correctness, not for throughput.
+struct memory_sink
+{
+    struct records
+    {
+        std::vector<std::string>    names;  // Indexed by name id
+        std::vector<task_info>      tasks;
+        std::vector<group_info>     groups;
+        std::vector<steal_info>     steals;
+    };
+
+    static uint32_t register_name(const std::string &name)
+    {
+        auto &s = storage();
+        std::lock_guard<std::mutex> __l(s.mutex);
+        const auto it = s.nameIds.find(name);
+        if (it != s.nameIds.end())
+        {
+            return it->second;
+        }
+        const auto nameId = uint32_t(s.recorded.names.size());
+        s.nameIds.emplace(name, nameId);
+        s.recorded.names.push_back(name);
+        return nameId;
+    }
+
+    static void send(const task_info &ti)
+    {
+        auto &s = storage();
+        std::lock_guard<std::mutex> __l(s.mutex);
+        s.recorded.tasks.push_back(ti);
+    }
+
+    static void send(const group_info &gi)
+    {
+        auto &s = storage();
+        std::lock_guard<std::mutex> __l(s.mutex);
+        s.recorded.groups.push_back(gi);
+    }
+
+    static void send(const steal_info &si)
+    {
+        auto &s = storage();
+        std::lock_guard<std::mutex> __l(s.mutex);
+        s.recorded.steals.push_back(si);
+    }
+
+    static void use_shared_staging_buffer()
+    {}
+
+    // Returns the records sent so far and forgets them, names are kept since their ids stay valid
+    static records take()
+    {
+        auto &s = storage();
+        std::lock_guard<std::mutex> __l(s.mutex);
+        records taken;
+        taken.names = s.recorded.names;
+        taken.tasks.swap(s.recorded.tasks);
+        taken.groups.swap(s.recorded.groups);
+        taken.steals.swap(s.recorded.steals);
+        return taken;
+    }
+
+private:
+    struct state
+    {
+        std::mutex                                  mutex;
+        std::unordered_map<std::string, uint32_t>   nameIds;
+        records                                     recorded;
+    };
+
+    static state& storage()
+    {
+        static state s;
+        return s;
+    }
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Drops everything
+struct null_sink
+{
+    static uint32_t register_name(const std::string &)
+    {
+        return invalid_name_id;
+    }
+
+    template<typename _Record>
+    static void send(const _Record &)
+    {}
+
+    static void use_shared_staging_buffer()
+    {}
+};
@@ -0,0 +1,283 @@
+#pragma once
+
+#include <map>
+#include <array>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "timeline.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Incrementally updated mipmap of the occupancy of each lane (core or thread).
+// Level 0 buckets span baseBucketNs, each level above is fanout times coarser. A task is added the
+// way a segment tree stores an interval: buckets it fully covers are marked once, at the coarsest
+// level where they are aligned, and only the few buckets it partially overlaps are updated at the
+// other levels. Adding a task is thus O(levels), and a query reads one level, the one matching the
+// requested resolution, in time proportional to the number of buckets returned.
+// Buckets live in sparse tiles, each level keeps a bounded number of tiles per lane: fine levels
+// only cover the recent past, coarse ones cover the whole session.
+class tile_pyramid
+{
+public:
+    static constexpr uint32_t fanout    = 4;
+    static constexpr uint32_t tile_size = 64; // Buckets per tile
+
+    struct config
+    {
+        uint64_t    baseBucketNs        = 1024;
+        // With the default base, the top level buckets span ~5 hours
+        uint32_t    levelCount          = 18;
+        // Per lane and per level, the oldest tiles are evicted beyond that
+        size_t      maxTilesPerLevel    = 256;
+    };
+
+public:
+    explicit tile_pyramid(lane_kind kind)
+        : tile_pyramid(kind, config())
+    {}
+
+    tile_pyramid(lane_kind kind, const config &cfg)
+        : config_(cfg)
+        , kind_(kind)
+        , evictedUntil_(cfg.levelCount, 0)
+    {
+        oqpi_check(config_.levelCount > 0 && config_.baseBucketNs > 0);
+    }
+
+    // Adds a task that ran on the given lane over [startNs, stopNs)
+    void add(uint64_t laneKey, uint64_t startNs, uint64_t stopNs, uint32_t nameId)
+    {
+        // Zero length tasks are still counted
+        stopNs = std::max(stopNs, startNs + 1);
+
+        auto &l = lanes_[laneKey];
+        if (l.levels.empty())
+        {
+            l.levels.resize(config_.levelCount);
+        }
+
+        for (uint32_t level = 0; level < config_.levelCount; ++level)
+        {
+            const auto size = bucketNs(level);
+            auto &tiles = l.levels[level];
+
+            if (auto *n = touch(tiles, level, startNs / size))
+            {
+                ++n->summary.taskCount;
+            }
+
+            // Buckets only partially overlapped, at most two of them
+            const auto first     = startNs / size;
+            const auto last      = (stopNs - 1) / size;
+            const auto firstFull = (startNs + size - 1) / size;
+            const auto endFull   = stopNs / size;
+            if (first < firstFull)
+            {
+                addBusy(tiles, level, first, std::min(stopNs, (first + 1) * size) - startNs, nameId, false);
+            }
+            if (last >= endFull && (last != first || first >= firstFull))
+            {
+                addBusy(tiles, level, last, stopNs - last * size, nameId, false);
+            }
+
+            // Fully covered buckets whose parent isn't
+            auto coverFrom = firstFull;
+            auto coverTo = endFull;
+            if (level + 1 < config_.levelCount)
+            {
+                const auto parentSize = size * fanout;
+                const auto parentFrom = (startNs + parentSize - 1) / parentSize * fanout;
+                const auto parentTo   = stopNs / parentSize * fanout;
+                if (parentFrom < parentTo)
+                {
+                    for (auto b = parentTo; b < endFull; ++b)
+                    {
+                        addBusy(tiles, level, b, size, nameId, true);
+                    }
+                    coverTo = std::min(coverTo, parentFrom);
+                }
+            }
+            for (auto b = coverFrom; b < coverTo; ++b)
+            {
+                addBusy(tiles, level, b, size, nameId, true);
+            }
+        }
+    }
+
+    // Summary of [fromNs, toNs) in at most bucketCount + 1 buckets. The returned range is aligned on
+    // the buckets of the level used, which is coarser than requested when the finer levels no longer
+    // cover fromNs.
+    timeline query(uint64_t fromNs, uint64_t toNs, uint32_t bucketCount) const
+    {
+        toNs = std::max(toNs, fromNs + 1);
+        bucketCount = std::max(1u, bucketCount);
+        const auto requestedNs = std::max<uint64_t>(1, (toNs - fromNs) / bucketCount);
+
+        uint32_t level = 0;
+        while (level + 1 < config_.levelCount && (bucketNs(level + 1) <= requestedNs || fromNs < evictedUntil_[level]))
+        {
+            ++level;
+        }
+
+        const auto size = bucketNs(level);
+        const auto stride = std::max<uint64_t>(1, (requestedNs + size - 1) / size);
+
+        timeline tl;
+        tl.kind         = kind_;
+        tl.bucketNs     = size * stride;
+        tl.fromNs       = fromNs / tl.bucketNs * tl.bucketNs;
+        tl.bucketCount  = uint32_t((toNs - tl.fromNs + tl.bucketNs - 1) / tl.bucketNs);
+
+        const auto firstBucket = tl.fromNs / size;
+        std::vector<tile_cursor> cursors(config_.levelCount);
+        for (const auto &entry : lanes_)
+        {
+            timeline_lane lane;
+            lane.key = entry.first;
+            lane.buckets.resize(tl.bucketCount);
+
+            auto empty = true;
+            std::fill(cursors.begin(), cursors.end(), tile_cursor());
+            for (uint32_t i = 0; i < tl.bucketCount; ++i)
+            {
+                auto &out = lane.buckets[i];
+                for (uint64_t j = 0; j < stride; ++j)
+                {
+                    const auto bucket = firstBucket + i * stride + j;
+                    if (const auto *n = lookup(entry.second.levels[level], bucket, cursors[level]))
+                    {
+                        merge(out, n->summary);
+                    }
+
+                    // Tasks covering an ancestor cover this bucket as well
+                    auto ancestor = bucket;
+                    for (auto l = level + 1; l < config_.levelCount; ++l)
+                    {
+                        ancestor /= fanout;
+                        const auto *a = lookup(entry.second.levels[l], ancestor, cursors[l]);
+                        if (a && a->covers > 0)
+                        {
+                            out.busyNs += a->covers * size;
+                            out.vote(a->summary.nameId, a->covers * size);
+                        }
+                    }
+                }
+                empty &= (out.busyNs == 0 && out.taskCount == 0);
+            }
+
+            if (!empty)
+            {
+                tl.lanes.push_back(std::move(lane));
+            }
+        }
+        return tl;
+    }
+
+    uint64_t bucketNs(uint32_t level) const
+    {
+        static_assert(fanout == 4, "bucket sizes are computed with shifts");
+        return config_.baseBucketNs << (2 * level);
+    }
+
+    size_t tileCount() const
+    {
+        size_t count = 0;
+        for (const auto &entry : lanes_)
+        {
+            for (const auto &tiles : entry.second.levels)
+            {
+                count += tiles.size();
+            }
+        }
+        return count;
+    }
+
+private:
+    struct node
+    {
+        // Busy time and names of the tasks below this bucket, covering ancestors excluded.
+        // taskCount is the number of tasks that started in the bucket.
+        timeline_bucket summary;
+        // Number of tasks covering the whole bucket but not its parent
+        uint32_t        covers = 0;
+    };
+
+    using tile      = std::array<node, tile_size>;
+    using tile_map  = std::map<uint64_t, std::unique_ptr<tile>>;
+
+    struct lane
+    {
+        std::vector<tile_map> levels;
+    };
+
+    struct tile_cursor
+    {
+        uint64_t    index   = UINT64_MAX;
+        const tile  *pTile  = nullptr;
+    };
+
+private:
+    void addBusy(tile_map &tiles, uint32_t level, uint64_t bucket, uint64_t busyNs, uint32_t nameId, bool covers)
+    {
+        if (auto *n = touch(tiles, level, bucket))
+        {
+            n->summary.busyNs += busyNs;
+            n->summary.vote(nameId, busyNs);
+            n->covers += covers ? 1 : 0;
+        }
+    }
+
+    // Returns nullptr for buckets that were already evicted
+    node* touch(tile_map &tiles, uint32_t level, uint64_t bucket)
+    {
+        const auto index = bucket / tile_size;
+        auto it = tiles.find(index);
+        if (it == tiles.end())
+        {
+            if (tiles.size() >= config_.maxTilesPerLevel && index < tiles.begin()->first)
+            {
+                return nullptr;
+            }
+
+            it = tiles.emplace(index, std::unique_ptr<tile>(new tile)).first;
+            if (tiles.size() > config_.maxTilesPerLevel)
+            {
+                const auto evictedEnd = (tiles.begin()->first + 1) * tile_size * bucketNs(level);
+                evictedUntil_[level] = std::max(evictedUntil_[level], evictedEnd);
+                tiles.erase(tiles.begin());
+            }
+        }
+        return &(*it->second)[bucket % tile_size];
+    }
+
+    static const node* lookup(const tile_map &tiles, uint64_t bucket, tile_cursor &cursor)
+    {
+        const auto index = bucket / tile_size;
+        if (index != cursor.index)
+        {
+            const auto it = tiles.find(index);
+            cursor.index = index;
+            cursor.pTile = (it != tiles.end()) ? it->second.get() : nullptr;
+        }
+        return cursor.pTile ? &(*cursor.pTile)[bucket % tile_size] : nullptr;
+    }
+
+    static void merge(timeline_bucket &out, const timeline_bucket &in)
+    {
+        out.busyNs += in.busyNs;
+        out.taskCount += in.taskCount;
+        if (in.nameWeight > 0)
+        {
+            out.vote(in.nameId, in.nameWeight);
+        }
+    }
+
+private:
+    const config                config_;
+    const lane_kind             kind_;
+    std::map<uint64_t, lane>    lanes_;
+    // Per level, time before which tiles were evicted for at least one lane
+    std::vector<uint64_t>       evictedUntil_;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "telemetry_protocol.hpp"
+
+
+//--------------------------------------------------------------------------------------------------
+// Level of detail summary of a time range: one row per core (or thread), one bucket per pixel.
+//--------------------------------------------------------------------------------------------------
+enum class lane_kind : uint8_t
+{
+    core,
+    thread,
+};
+
+struct timeline_bucket
+{
+    uint64_t    busyNs      = 0;
+    // Tasks that started in the bucket
+    uint32_t    taskCount   = 0;
+    // Name having spent the most time in the bucket, tracked with a weighted majority vote
+    // (Misra-Gries with a single counter) so that it doesn't need any extra memory.
+    uint32_t    nameId      = invalid_name_id;
+    uint64_t    nameWeight  = 0;
+
+    void add(uint32_t name, uint64_t busy)
+    {
+        busyNs += busy;
+        ++taskCount;
+        vote(name, std::max<uint64_t>(busy, 1));
+    }
+
+    void vote(uint32_t name, uint64_t weight)
+    {
+        if (name == nameId)
+        {
+            nameWeight += weight;
+        }
+        else if (weight > nameWeight)
+        {
+            nameId = name;
+            nameWeight = weight - nameWeight;
+        }
+        else
+        {
+            nameWeight -= weight;
+        }
+    }
+};
+
+struct timeline_lane
+{
+    uint64_t                        key = 0; // Core or thread id
+    std::vector<timeline_bucket>    buckets;
+};
+
+struct timeline
+{
+    uint64_t                    fromNs      = 0;
+    uint64_t                    bucketNs    = 1;
+    uint32_t                    bucketCount = 0;
+    lane_kind                   kind        = lane_kind::core;
+    std::vector<timeline_lane>  lanes;  // Sorted by key
+};
+
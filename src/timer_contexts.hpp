@@ -1,167 +1,315 @@
 #pragma once
 
 #include <chrono>
-#include <unordered_map>
 #include "oqpi.hpp"
-#include "visualizer_client.hpp"
+#include "telemetry_clock.hpp"
+#include "telemetry_protocol.hpp"
+#include "telemetry_sinks.hpp"
+#include "scheduled_queue.hpp"
 
 
-int64_t query_performance_counter_aux()
+//--------------------------------------------------------------------------------------------------
+// Telemetry policies, selecting at compile time what the timer contexts do:
+//  - enabled:          false compiles the instrumentation out, the contexts are empty and do nothing
+//  - capture_threads:  threads on which tasks start and stop
+//  - capture_cores:    cores on which tasks start and stop
+//  - clock:            timestamps source, see telemetry_clock.hpp
+//  - sink:             destination of the records, see telemetry_sinks.hpp
+// Fields that are not captured are not stored in the contexts, they are sent as unknown_thread and
+// unknown_core, which the server leaves out of its thread and core views.
+// The time a task was scheduled at is only known when the scheduler uses a scheduled_queue with the
+// clock of the policy, see scheduled_queue.hpp.
+//--------------------------------------------------------------------------------------------------
+
+// Everything the visualizer can show
+struct full_trace_telemetry
 {
-    LARGE_INTEGER li;
-    QueryPerformanceCounter(&li);
-    return li.QuadPart;
-}
+    static constexpr bool   enabled         = true;
+    static constexpr bool   capture_threads = true;
+    static constexpr bool   capture_cores   = true;
+    using clock = telemetry_clock;
+    using sink  = network_sink<clock>;
+};
 
-int64_t first_measure()
+// Timestamps and threads, without the cost of looking up the current core twice per task
+struct release_telemetry
 {
-    static const auto firstMeasure = query_performance_counter_aux();
-    return firstMeasure;
-}
+    static constexpr bool   enabled         = true;
+    static constexpr bool   capture_threads = true;
+    static constexpr bool   capture_cores   = false;
+    using clock = telemetry_clock;
+    using sink  = network_sink<clock>;
+};
 
-uint32_t query_performance_counter()
+// Compiled out
+struct no_telemetry
 {
-    first_measure();
-    const auto t = query_performance_counter_aux();
-    return uint32_t(t - first_measure());
-}
+    static constexpr bool   enabled         = false;
+    static constexpr bool   capture_threads = false;
+    static constexpr bool   capture_cores   = false;
+    using clock = telemetry_clock;
+    using sink  = null_sink;
+};
+
 
-int64_t query_performance_frequency()
+//--------------------------------------------------------------------------------------------------
+// Optional fields of the execution of a task, empty when not captured
+template<bool _Captured>
+struct thread_capture
 {
-    LARGE_INTEGER li;
-    QueryPerformanceFrequency(&li);
-    return li.QuadPart;
-}
+    void onStart()
+    {
+        startedOnThread_ = oqpi::this_thread::get_id();
+    }
+
+    void fill(task_info &ti) const
+    {
+        ti.startedOnThread = startedOnThread_;
+        ti.stoppedOnThread = oqpi::this_thread::get_id();
+    }
 
-double duration(int64_t s, int64_t e)
+    task_info::thread_id startedOnThread_ = unknown_thread;
+};
+
+template<>
+struct thread_capture<false>
 {
-    static const auto F = query_performance_frequency();
-    auto dt = e - s;
-    return (dt / (F*1.0)) * 1000.0;
-}
+    void onStart() {}
+    void fill(task_info &) const {}
+};
 
-enum opcode : uint8_t
+template<bool _Captured>
+struct core_capture
 {
-    register_task,
-    unregister_task,
-    add_to_group,
-    start_task,
-    end_task,
+    void onStart()
+    {
+        startedOnCore_ = uint8_t(oqpi::this_thread::get_current_core());
+    }
 
-    count
+    void fill(task_info &ti) const
+    {
+        ti.startedOnCore = startedOnCore_;
+        ti.stoppedOnCore = uint8_t(oqpi::this_thread::get_current_core());
+    }
+
+    uint8_t startedOnCore_ = unknown_core;
 };
 
-struct task_info
+template<>
+struct core_capture<false>
 {
-    using thread_id = oqpi::thread_interface<>::id;
-
-    oqpi::task_uid  uid             = oqpi::invalid_task_uid;
-    oqpi::task_uid  groupUID        = oqpi::invalid_task_uid;
-    uint32_t        startedAt       = 0;
-    uint32_t        stoppedAt       = 0;
-    thread_id       startedOnThread = 0;
-    thread_id       stoppedOnThread = 0;
-    uint8_t         startedOnCore   = 0xFF;
-    uint8_t         stoppedOnCore   = 0xFF;
+    void onStart() {}
+    void fill(task_info &) const {}
 };
 
-class timing_registry
+
+//--------------------------------------------------------------------------------------------------
+// Execution of a task or a group, captured and sent as a task_info record
+template<typename _Policy>
+class timed_execution
+    : private thread_capture<_Policy::capture_threads>
+    , private core_capture<_Policy::capture_cores>
 {
-public:
+    using threads   = thread_capture<_Policy::capture_threads>;
+    using cores     = core_capture<_Policy::capture_cores>;
+    using clock     = typename _Policy::clock;
+    using sink      = typename _Policy::sink;
 
-    timing_registry()
+public:
+    timed_execution(const oqpi::task_base *pOwner, const std::string &name)
+        : uid_(pOwner->getUID())
+        , groupUID_(oqpi::invalid_task_uid)
+        , scheduledAt_(not_scheduled)
+        , startedAt_(0)
+        , nameId_(sink::register_name(name))
+        , priority_(uint8_t(pOwner->getPriority()))
     {}
 
-    static timing_registry& get()
+    void setGroup(oqpi::task_uid groupUID)
+    {
+        groupUID_ = groupUID;
+    }
+
+    void start()
     {
-        static timing_registry instance;
-        return instance;
+        // Set by the queue if this task is what the worker just popped
+        const auto &dequeued = last_dequeued_task();
+        scheduledAt_ = dequeued.uid == uid_ ? dequeued.scheduledAt : not_scheduled;
+        cores::onStart();
+        threads::onStart();
+        startedAt_ = clock::now();
     }
 
-    void send(const task_info &ti, const std::string &name)
+    void stop()
     {
-        client_.encodeAndSend(ti, name);
+        task_info ti;
+        ti.stoppedAt    = clock::now();
+        cores::fill(ti);
+        threads::fill(ti);
+        ti.uid          = uid_;
+        ti.groupUID     = groupUID_;
+        ti.nameId       = nameId_;
+        ti.priority     = priority_;
+        ti.scheduledAt  = scheduledAt_;
+        ti.startedAt    = startedAt_;
+        sink::send(ti);
+    }
+
+    void sendGroupInfo() const
+    {
+        group_info gi;
+        gi.uid      = uid_;
+        gi.groupUID = groupUID_;
+        gi.nameId   = nameId_;
+        sink::send(gi);
     }
 
 private:
-    visualizer_client client_;
+    oqpi::task_uid  uid_;
+    oqpi::task_uid  groupUID_;
+    uint64_t        scheduledAt_;
+    uint64_t        startedAt_;
+    uint32_t        nameId_;
+    uint8_t         priority_;
 };
 
-class timer_task_context
+
+//--------------------------------------------------------------------------------------------------
+// Names are only kept as ids and records are encoded in place in the staging buffer of the thread:
+// once a thread has seen a name, instrumenting a task doesn't allocate (checked by oqpi_benchmarks).
+template<typename _Policy, bool _Enabled = _Policy::enabled>
+class basic_timer_task_context
     : public oqpi::task_context_base
 {
 public:
-    timer_task_context(oqpi::task_base *pOwner, const std::string &name)
+    basic_timer_task_context(oqpi::task_base *pOwner, const std::string &name)
         : oqpi::task_context_base(pOwner, name)
-    {
-        ti_.uid = pOwner->getUID();
-        name_   = name;
-    }
-
-    ~timer_task_context()
-    {
-        timing_registry::get().send(ti_, name_);
-    }
+        , execution_(pOwner, name)
+    {}
 
     inline void onAddedToGroup(const oqpi::task_group_sptr &spParentGroup)
     {
-        ti_.groupUID = spParentGroup->getUID();
+        execution_.setGroup(spParentGroup->getUID());
     }
 
     inline void onPreExecute()
     {
-        ti_.startedOnCore   = oqpi::this_thread::get_current_core();
-        ti_.startedOnThread = oqpi::this_thread::get_id();
-        ti_.startedAt       = query_performance_counter();
+        execution_.start();
     }
 
     inline void onPostExecute()
     {
-        ti_.stoppedAt       = query_performance_counter();
-        ti_.startedOnCore   = oqpi::this_thread::get_current_core();
-        ti_.startedOnThread = oqpi::this_thread::get_id();
+        execution_.stop();
     }
 
-    task_info   ti_;
-    std::string name_;
+private:
+    timed_execution<_Policy> execution_;
 };
 
+template<typename _Policy>
+class basic_timer_task_context<_Policy, false>
+    : public oqpi::task_context_base
+{
+public:
+    basic_timer_task_context(oqpi::task_base *pOwner, const std::string &name)
+        : oqpi::task_context_base(pOwner, name)
+    {}
+
+    inline void onAddedToGroup(const oqpi::task_group_sptr &) {}
+    inline void onPreExecute() {}
+    inline void onPostExecute() {}
+};
 
-class timer_group_context
+
+//--------------------------------------------------------------------------------------------------
+template<typename _Policy, bool _Enabled = _Policy::enabled>
+class basic_timer_group_context
     : public oqpi::group_context_base
 {
 public:
-    timer_group_context(oqpi::task_group_base *pOwner, const std::string &name)
+    basic_timer_group_context(oqpi::task_group_base *pOwner, const std::string &name)
         : oqpi::group_context_base(pOwner, name)
+        , execution_(pOwner, name)
     {
-        ti_.uid = pOwner->getUID();
-        name_ = name;
-    }
-
-    ~timer_group_context()
-    {
+        // Let the server know about the group before any of its children is done
+        execution_.sendGroupInfo();
     }
 
     inline void onAddedToGroup(const oqpi::task_group_sptr &spParentGroup)
     {
-        ti_.groupUID = spParentGroup->getUID();
+        execution_.setGroup(spParentGroup->getUID());
+        execution_.sendGroupInfo();
     }
 
     inline void onPreExecute()
     {
-        ti_.startedOnCore = oqpi::this_thread::get_current_core();
-        ti_.startedOnThread = oqpi::this_thread::get_id();
-        ti_.startedAt = query_performance_counter();
+        execution_.start();
     }
 
     inline void onPostExecute()
     {
-        ti_.stoppedAt = query_performance_counter();
-        ti_.startedOnCore = oqpi::this_thread::get_current_core();
-        ti_.startedOnThread = oqpi::this_thread::get_id();
-        timing_registry::get().send(ti_, name_);
+        execution_.stop();
+    }
+
+private:
+    timed_execution<_Policy> execution_;
+};
+
+template<typename _Policy>
+class basic_timer_group_context<_Policy, false>
+    : public oqpi::group_context_base
+{
+public:
+    basic_timer_group_context(oqpi::task_group_base *pOwner, const std::string &name)
+        : oqpi::group_context_base(pOwner, name)
+    {}
+
+    inline void onAddedToGroup(const oqpi::task_group_sptr &) {}
+    inline void onPreExecute() {}
+    inline void onPostExecute() {}
+};
+
+
+//--------------------------------------------------------------------------------------------------
+// Records the steals of a work_stealing_queue, threads are always captured since they are what a
+// steal is about
+template<typename _Policy, bool _Enabled = _Policy::enabled>
+struct basic_timer_steal_observer
+{
+    static uint64_t thread_tag()
+    {
+        return uint64_t(oqpi::this_thread::get_id());
+    }
+
+    static void on_steal(uint64_t victimTag)
+    {
+        steal_info si;
+        si.stolenAt     = _Policy::clock::now();
+        si.thief        = oqpi::this_thread::get_id();
+        si.victim       = steal_info::thread_id(victimTag);
+        if (_Policy::capture_cores)
+        {
+            si.thiefCore = uint8_t(oqpi::this_thread::get_current_core());
+        }
+        _Policy::sink::send(si);
     }
+};
 
-    task_info   ti_;
-    std::string name_;
+template<typename _Policy>
+struct basic_timer_steal_observer<_Policy, false>
+{
+    static uint64_t thread_tag()
+    {
+        return 0;
+    }
+
+    static void on_steal(uint64_t)
+    {}
 };
+
+
+//--------------------------------------------------------------------------------------------------
+// Full trace sent to the telemetry server
+using timer_task_context    = basic_timer_task_context<full_trace_telemetry>;
+using timer_group_context   = basic_timer_group_context<full_trace_telemetry>;
+using timer_steal_observer  = basic_timer_steal_observer<full_trace_telemetry>;
@@ -1,11 +1,24 @@
 #pragma once
 
 #include <mutex>
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <unordered_map>
+#include <type_traits>
 
 #define ASIO_STANDALONE
 #include "asio.hpp"
 
 #include "ring_buffer.hpp"
+#include "mpsc_ring_buffer.hpp"
+#include "shared_memory_ring.hpp"
+#include "task_columns.hpp"
+#include "telemetry_clock.hpp"
+#include "telemetry_protocol.hpp"
 
 
 class visualizer_client
@@ -13,35 +26,208 @@ class visualizer_client
 public:
     using buffer_type = std::vector<uint8_t>;
 
+    // Largest staged record, size and opcode included
+    static constexpr size_t max_entry_size = 256;
+
+    struct config
+    {
+        std::string                 host                    = "localhost";
+        std::string                 port                    = "9000";
+        // Size of the per thread staging buffer in which records are written before being sent,
+        // rounded up to a power of two
+        int32_t                     stagingBufferSize       = 64 * 1024;
+        // Size of the buffer shared by the threads calling useSharedStagingBuffer()
+        int32_t                     sharedStagingBufferSize = 256 * 1024;
+        // A frame is sent as soon as it reaches this size...
+        uint32_t                    batchSize               = 64 * 1024;
+        // ...or when its oldest record has been waiting for that long
+        std::chrono::milliseconds   flushInterval           = std::chrono::milliseconds(10);
+        // Frequency of the clock timestamping the records, telemetry_clock's when 0
+        uint64_t                    ticksPerSecond          = 0;
+        // When the server runs on this machine, frames go through shared memory rather than TCP
+        bool                        sharedMemory            = true;
+        // Size of the shared memory ring, rounded up to a power of two
+        uint32_t                    sharedMemorySize        = 8 * 1024 * 1024;
+        // Tasks are sent as end_task_packed frames, see task_column_codec
+        bool                        compressTasks           = true;
+    };
+
 public:
     visualizer_client()
-        : socket_(ioService_)
+        : visualizer_client(config())
+    {}
+
+    explicit visualizer_client(const config &cfg)
+        : config_(cfg)
+        , slot_(nextSlot())
+        , socket_(ioService_)
+        , running_(true)
+        , droppedRecords_(0)
+        , sharedStagingBuffer_(cfg.sharedStagingBufferSize)
+        , sharedDroppedRecords_(0)
+        , nameCount_(0)
+        , sentNameCount_(0)
+        , pendingSize_(0)
     {
+        oqpi_check(config_.batchSize > sizeof(frame_header) && config_.batchSize <= max_frame_size);
+
         asio::ip::tcp::resolver resolver(ioService_);
-        asio::ip::tcp::resolver::query query("localhost", "9000");
+        asio::ip::tcp::resolver::query query(config_.host, config_.port);
         auto endPointIt = resolver.resolve(query);
         asio::connect(socket_, endPointIt);
+        if (config_.sharedMemory)
+        {
+            attachSharedMemory(endPointIt);
+        }
+        sendClockInfo();
+
+        senderThread_ = oqpi::thread_interface<>("oqpi::visualizer_sender", [this]
+        {
+            senderLoop();
+        });
+    }
+
+    ~visualizer_client()
+    {
+        running_.store(false);
+        if (senderThread_.joinable())
+        {
+            senderThread_.join();
+        }
+
+        const auto dropped = droppedRecords_.load();
+        if (dropped > 0)
+        {
+            std::cerr << "visualizer_client: " << dropped << " records dropped, staging buffers were full" << std::endl;
+        }
     }
 
 public:
+    // Encodes a record in the staging buffer of the calling thread.
+    // The record will be added to a frame of the given opcode and sent later on by the sender thread,
+    // this never blocks.
     template<typename ..._Args>
-    void encodeAndSend(_Args &&...args)
-    {
-        buffer_type buffer(1024);
-        size_t offset = sizeof(uint16_t); // First 2 bytes contain the size of the message
-        encode(buffer, offset, std::forward<_Args>(args)...);
-        buffer.resize(offset);
-        const auto msgSize = uint16_t(buffer.size());
-        memcpy(buffer.data(), &msgSize, sizeof(msgSize));
-        send(buffer);
+    void encodeAndSend(opcode op, _Args &&...args)
+    {
+        // First 2 bytes contain the size of the staged record
+        constexpr auto entrySize = uint16_t(sizeof(uint16_t) + encoded_size<opcode, _Args...>::value);
+        static_assert(entrySize <= max_entry_size, "record too large to be staged");
+
+        auto &state = threadState();
+        if (state.usesSharedStagingBuffer)
+        {
+            std::array<uint8_t, entrySize> entry;
+            memcpy(entry.data(), &entrySize, sizeof(entrySize));
+            size_t offset = sizeof(entrySize);
+            encode(entry.data(), offset, op, std::forward<_Args>(args)...);
+            if (!sharedStagingBuffer_.write(entry.data(), int32_t(entrySize)))
+            {
+                sharedDroppedRecords_.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+
+        auto &buffer = stagingBuffer(state);
+        auto pEntry = buffer.records.reserve(int32_t(entrySize));
+        if (pEntry == nullptr)
+        {
+            // Only this thread writes the counter, the sender thread takes it
+            buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        memcpy(pEntry, &entrySize, sizeof(entrySize));
+        size_t offset = sizeof(entrySize);
+        encode(pEntry, offset, op, std::forward<_Args>(args)...);
+        buffer.records.commit(int32_t(entrySize));
+    }
+
+    // Whether the frames go through shared memory rather than TCP, decided once connected
+    bool usesSharedMemory() const
+    {
+        return spSharedMemory_ != nullptr;
+    }
+
+    // Records lost so far because a staging buffer was full. They are also reported to the server,
+    // as dropped_records frames.
+    uint64_t droppedRecords() const
+    {
+        return droppedRecords_.load(std::memory_order_relaxed);
+    }
+
+    // Makes the calling thread stage its records in a buffer shared with the other threads that did
+    // the same, rather than in a buffer of its own. Meant for threads that emit few records, such as
+    // the main thread or IO threads: no buffer to allocate, no buffer to drain.
+    void useSharedStagingBuffer()
+    {
+        threadState().usesSharedStagingBuffer = true;
+    }
+
+    // Returns the id of the given name, registering it the first time it is seen.
+    // Each thread keeps a cache of the names it already resolved so that the lock is only taken once per name.
+    uint32_t registerName(const std::string &name)
+    {
+        auto &localNameIds = threadState().nameIds;
+        const auto localIt = localNameIds.find(name);
+        if (localIt != localNameIds.end())
+        {
+            return localIt->second;
+        }
+
+        uint32_t nameId = invalid_name_id;
+        {
+            std::lock_guard<std::mutex> __l(namesMutex_);
+            const auto it = nameIds_.find(name);
+            if (it != nameIds_.end())
+            {
+                nameId = it->second;
+            }
+            else
+            {
+                nameId = uint32_t(names_.size());
+                nameIds_.emplace(name, nameId);
+                names_.push_back(name);
+                nameCount_.store(uint32_t(names_.size()), std::memory_order_release);
+            }
+        }
+        localNameIds.emplace(name, nameId);
+        return nameId;
     }
 
     void send(const buffer_type &buffer)
     {
+        if (spSharedMemory_)
+        {
+            // Frames are written whole, as many at once as the ring can take: a write that times out
+            // leaves nothing behind, the server still finds a frame header where it resumes reading
+            const auto capacity = spSharedMemory_->capacity();
+            size_t offset = 0;
+            while (offset < buffer.size())
+            {
+                auto end = offset;
+                while (end < buffer.size())
+                {
+                    frame_header header;
+                    memcpy(&header, buffer.data() + end, sizeof(header));
+                    if (end > offset && end + header.size - offset > capacity)
+                    {
+                        break;
+                    }
+                    end += header.size;
+                }
+
+                if (!spSharedMemory_->write(buffer.data() + offset, end - offset))
+                {
+                    std::cerr << "visualizer_client: the server stopped reading the shared memory, frames dropped" << std::endl;
+                    return;
+                }
+                offset = end;
+            }
+            return;
+        }
+
         try
         {
-            //std::lock_guard<std::mutex> __l(mutex);
-            //socket_.send(asio::buffer(buffer));
             asio::write(socket_, asio::buffer(buffer));
         }
         catch (std::exception& e)
@@ -51,34 +237,436 @@ public:
     }
 
 private:
+    struct staging_buffer
+    {
+        explicit staging_buffer(int32_t size)
+            : records(size)
+            , dropped(0)
+        {}
+
+        ring_buffer             records;
+        // Not reported yet
+        std::atomic<uint64_t>   dropped;
+    };
+    using staging_buffers = std::vector<std::shared_ptr<staging_buffer>>;
+
+    // What a thread keeps for a given client
+    struct thread_state
+    {
+        std::shared_ptr<staging_buffer>             spStagingBuffer;
+        std::unordered_map<std::string, uint32_t>   nameIds;
+        bool                                        usesSharedStagingBuffer = false;
+    };
+
+    // A thread can record through several clients, e.g. one per clock, each client thus has a slot of
+    // its own in the thread local states. Slots are not reused: clients are meant to live as long as
+    // the process, the state of a thread for a destroyed client stays around until the thread exits.
+    static uint32_t nextSlot()
+    {
+        static std::atomic<uint32_t> slotCount(0);
+        return slotCount.fetch_add(1);
+    }
+
+    thread_state& threadState()
+    {
+        static thread_local std::vector<std::unique_ptr<thread_state>> states;
+        if (slot_ >= states.size())
+        {
+            states.resize(slot_ + 1);
+        }
+        auto &spState = states[slot_];
+        if (!spState)
+        {
+            spState.reset(new thread_state());
+        }
+        return *spState;
+    }
+
+    // Each thread writes in its own buffer, the first call on a given thread registers it
+    staging_buffer& stagingBuffer(thread_state &state)
+    {
+        if (!state.spStagingBuffer)
+        {
+            state.spStagingBuffer = registerStagingBuffer();
+        }
+        return *state.spStagingBuffer;
+    }
+
+    std::shared_ptr<staging_buffer> registerStagingBuffer()
+    {
+        auto spBuffer = std::make_shared<staging_buffer>(config_.stagingBufferSize);
+        std::lock_guard<std::mutex> __l(stagingBuffersMutex_);
+        stagingBuffers_.push_back(spBuffer);
+        return spBuffer;
+    }
+
+    void senderLoop()
+    {
+        outgoing_.reserve(config_.batchSize * 2);
+
+        for (;;)
+        {
+            const auto stopping = !running_.load();
+            const auto drained = drainStagingBuffers();
+
+            if (stopping || std::chrono::steady_clock::now() - oldestPendingRecord_ >= config_.flushInterval)
+            {
+                flush();
+            }
+
+            if (stopping)
+            {
+                // Whatever was written before we were asked to stop is sent now
+                break;
+            }
+
+            if (drained == 0)
+            {
+                oqpi::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    // Moves all the staged records into the pending frames, returns the number of records moved.
+    // Draining may flush, a blocking write: it goes through a copy of the list of buffers so that a
+    // thread registering its buffer meanwhile doesn't wait for the network.
+    uint32_t drainStagingBuffers()
+    {
+        uint32_t drained = 0;
+        uint64_t dropped = sharedDroppedRecords_.exchange(0, std::memory_order_relaxed);
+
+        {
+            std::lock_guard<std::mutex> __l(stagingBuffersMutex_);
+            drainedBuffers_ = stagingBuffers_;
+        }
+
+        for (const auto &spBuffer : drainedBuffers_)
+        {
+            auto &buffer = spBuffer->records;
+            dropped += spBuffer->dropped.exchange(0, std::memory_order_relaxed);
+
+            // A record is always committed in one go, if its size is readable so is the rest of it
+            while (auto pSize = buffer.peek(sizeof(uint16_t)))
+            {
+                uint16_t entrySize = 0;
+                memcpy(&entrySize, pSize, sizeof(entrySize));
+                const auto pEntry = buffer.peek(int32_t(entrySize));
+                oqpi_check(pEntry != nullptr);
+
+                stageRecord(pEntry, entrySize);
+                buffer.consume(int32_t(entrySize));
+                ++drained;
+            }
+        }
+        drainedBuffers_.clear();
+
+        {
+            // The owning thread is gone and everything it wrote has been sent
+            std::lock_guard<std::mutex> __l(stagingBuffersMutex_);
+            stagingBuffers_.erase(std::remove_if(stagingBuffers_.begin(), stagingBuffers_.end(), [](const std::shared_ptr<staging_buffer> &spBuffer)
+            {
+                return spBuffer.use_count() == 1 && spBuffer->records.usedSpace() == 0 && spBuffer->dropped.load() == 0;
+            }), stagingBuffers_.end());
+        }
+
+        // Records of the shared buffer are read piecewise, they may wrap around its end
+        uint16_t entrySize = 0;
+        while (sharedStagingBuffer_.read(entrySize))
+        {
+            std::array<uint8_t, max_entry_size> entry;
+            oqpi_check(entrySize > sizeof(entrySize) && entrySize <= entry.size());
+            memcpy(entry.data(), &entrySize, sizeof(entrySize));
+            sharedStagingBuffer_.read(entry.data() + sizeof(entrySize), int32_t(entrySize - sizeof(entrySize)));
+            stageRecord(entry.data(), entrySize);
+            ++drained;
+        }
+
+        if (dropped > 0)
+        {
+            stageDroppedRecords(dropped);
+        }
+        return drained;
+    }
+
+    // Appends a staged record to the pending frame of its opcode
+    void stageRecord(const uint8_t *pEntry, uint16_t entrySize)
+    {
+        opcode op = opcode::count;
+        memcpy(&op, pEntry + sizeof(entrySize), sizeof(op));
+        oqpi_check(op < opcode::count);
+
+        auto &frame = pendingFrames_[op];
+        if (frame.recordCount == 0)
+        {
+            frame.data.resize(sizeof(frame_header));
+        }
+        if (pendingSize_ == 0)
+        {
+            oldestPendingRecord_ = std::chrono::steady_clock::now();
+        }
+
+        const auto recordOffset = sizeof(entrySize) + sizeof(op);
+        frame.data.insert(frame.data.end(), pEntry + recordOffset, pEntry + entrySize);
+        ++frame.recordCount;
+        pendingSize_ += entrySize - recordOffset;
+
+        if (pendingSize_ >= config_.batchSize)
+        {
+            flush();
+        }
+    }
+
+    // Sent along with the records that made it, the server can tell how much it is missing
+    void stageDroppedRecords(uint64_t count)
+    {
+        droppedRecords_.fetch_add(count, std::memory_order_relaxed);
+
+        dropped_info di;
+        di.count = count;
+        constexpr auto entrySize = uint16_t(sizeof(uint16_t) + encoded_size<opcode, dropped_info>::value);
+        std::array<uint8_t, entrySize> entry;
+        memcpy(entry.data(), &entrySize, sizeof(entrySize));
+        size_t offset = sizeof(entrySize);
+        encode(entry.data(), offset, opcode::dropped_records, di);
+        stageRecord(entry.data(), entrySize);
+    }
+
+    // Sends all the pending frames at once, in opcode order so that groups are known before the
+    // tasks they contain. Names always go first since any record may refer to them.
+    void flush()
+    {
+        if (pendingSize_ == 0)
+        {
+            return;
+        }
+
+        outgoing_.clear();
+        appendPendingNames(outgoing_);
+
+        for (uint8_t op = 0; op < opcode::count; ++op)
+        {
+            auto &frame = pendingFrames_[op];
+            if (frame.recordCount == 0)
+            {
+                continue;
+            }
+
+            frame_header header;
+            header.recordCount  = frame.recordCount;
+            if (op == opcode::end_task && config_.compressTasks)
+            {
+                const auto frameOffset = outgoing_.size();
+                outgoing_.resize(frameOffset + sizeof(header));
+                taskCodec_.encode(frame.data.data() + sizeof(header), frame.recordCount, outgoing_);
+                header.size = uint32_t(outgoing_.size() - frameOffset);
+                header.op   = opcode::end_task_packed;
+                memcpy(outgoing_.data() + frameOffset, &header, sizeof(header));
+            }
+            else
+            {
+                header.size = uint32_t(frame.data.size());
+                header.op   = opcode(op);
+                memcpy(frame.data.data(), &header, sizeof(header));
+                outgoing_.insert(outgoing_.end(), frame.data.begin(), frame.data.end());
+            }
+            frame.data.clear();
+            frame.recordCount = 0;
+        }
+
+        send(outgoing_);
+        pendingSize_ = 0;
+    }
+
+    // Offers the server a shared memory ring when it is on this machine. A server that doesn't know
+    // about shared memory closes the connection, which is then opened again and kept as is.
+    void attachSharedMemory(asio::ip::tcp::resolver::iterator endPointIt)
+    {
+#if OQPI_VISUALIZER_HAS_SHARED_MEMORY
+        if (!socket_.remote_endpoint().address().is_loopback())
+        {
+            return;
+        }
+
+        std::unique_ptr<shared_memory_ring> spRing;
+        try
+        {
+            static std::atomic<uint32_t> ringCount(0);
+            const auto name = "/oqpi_visualizer_" + std::to_string(getpid()) + "_" + std::to_string(ringCount++);
+            spRing = shared_memory_ring::create(name, config_.sharedMemorySize);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "visualizer_client: " << e.what() << ", using TCP" << std::endl;
+            return;
+        }
+
+        // Frames are written whole, see send()
+        if (spRing->capacity() < largestFrameSize())
+        {
+            std::cerr << "visualizer_client: shared memory smaller than a frame, using TCP" << std::endl;
+            spRing->unlink();
+            return;
+        }
+
+        frame_header header;
+        header.size         = uint32_t(sizeof(frame_header) + sizeof(shared_memory_record));
+        header.recordCount  = 1;
+        header.op           = opcode::attach_shared_memory;
+
+        shared_memory_record record;
+        memcpy(record.name, spRing->name().c_str(), spRing->name().size());
+
+        buffer_type buffer(header.size);
+        memcpy(buffer.data(), &header, sizeof(header));
+        memcpy(buffer.data() + sizeof(header), &record, sizeof(record));
+
+        uint8_t accepted = 0;
+        asio::error_code error;
+        asio::write(socket_, asio::buffer(buffer), error);
+        if (!error)
+        {
+            asio::read(socket_, asio::buffer(&accepted, sizeof(accepted)), error);
+        }
+        // The server mapped it or won't ever
+        spRing->unlink();
+
+        if (error)
+        {
+            socket_.close(error);
+            asio::connect(socket_, endPointIt);
+        }
+        else if (accepted == 1)
+        {
+            spSharedMemory_ = std::move(spRing);
+        }
+#else
+        (void)endPointIt;
+#endif
+    }
+
+    void sendClockInfo()
+    {
+        frame_header header;
+        header.size         = uint32_t(sizeof(frame_header) + sizeof(clock_record));
+        header.recordCount  = 1;
+        header.op           = opcode::clock_info;
+
+        clock_record clock;
+        clock.ticksPerSecond = config_.ticksPerSecond ? config_.ticksPerSecond : telemetry_clock::ticks_per_second();
+
+        buffer_type buffer(header.size);
+        memcpy(buffer.data(), &header, sizeof(header));
+        memcpy(buffer.data() + sizeof(header), &clock, sizeof(clock));
+        send(buffer);
+    }
+
+    // Names are cut in frames of about batchSize, like the other records
+    void appendPendingNames(buffer_type &frames)
+    {
+        if (sentNameCount_ == nameCount_.load(std::memory_order_acquire))
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> __l(namesMutex_);
+        while (sentNameCount_ < uint32_t(names_.size()))
+        {
+            const auto frameOffset = frames.size();
+            frames.resize(frameOffset + sizeof(frame_header));
+            frame_header header;
+            header.op = opcode::register_task;
+            for (; sentNameCount_ < uint32_t(names_.size()) && frames.size() - frameOffset < config_.batchSize; ++sentNameCount_)
+            {
+                const auto &name = names_[sentNameCount_];
+                name_record nr;
+                nr.nameId = sentNameCount_;
+                nr.length = uint16_t(std::min<size_t>(name.size(), UINT16_MAX));
+
+                const auto offset = frames.size();
+                frames.resize(offset + sizeof(nr) + nr.length);
+                memcpy(frames.data() + offset, &nr, sizeof(nr));
+                memcpy(frames.data() + offset + sizeof(nr), name.data(), nr.length);
+                ++header.recordCount;
+            }
+            header.size = uint32_t(frames.size() - frameOffset);
+            memcpy(frames.data() + frameOffset, &header, sizeof(header));
+        }
+    }
+
+    // Upper bound of the frames flush() builds. The records of a frame are sent once they reach
+    // batchSize, the last one may cross it: packed tasks can take more room than raw ones, a frame
+    // of names holds at least one name whatever its length.
+    size_t largestFrameSize() const
+    {
+        const auto recordsSize = size_t(config_.batchSize) + max_entry_size;
+        const auto packedSize = (recordsSize / sizeof(task_info) + 1) * task_column_codec::max_record_size;
+        const auto namesSize = size_t(config_.batchSize) + sizeof(name_record) + UINT16_MAX;
+        return sizeof(frame_header) + std::max(std::max(recordsSize, packedSize), namesSize);
+    }
+
+private:
+    // Number of bytes taken by the given values once encoded
+    template<typename ..._Args>
+    struct encoded_size
+    {
+        static constexpr size_t value = 0;
+    };
+
     template<typename T, typename ..._Args>
-    void encode(buffer_type &buffer, size_t &offset, T &&t, _Args &&...args)
+    struct encoded_size<T, _Args...>
     {
-        encodeValue(buffer, offset, std::forward<T>(t));
-        encode(buffer, offset, std::forward<_Args>(args)...);
+        static constexpr size_t value = sizeof(typename std::decay<T>::type) + encoded_size<_Args...>::value;
+    };
+
+    template<typename T, typename ..._Args>
+    void encode(uint8_t *pEntry, size_t &offset, T &&t, _Args &&...args)
+    {
+        encodeValue(pEntry, offset, std::forward<T>(t));
+        encode(pEntry, offset, std::forward<_Args>(args)...);
     }
 
-    void encode(buffer_type &buffer, size_t &offset)
+    void encode(uint8_t *, size_t &)
     {}
 
     template<typename T>
-    void encodeValue(buffer_type &buffer, size_t &offset, T &&t)
+    void encodeValue(uint8_t *pEntry, size_t &offset, T &&t)
     {
-        memcpy(buffer.data() + offset, &t, sizeof(T));
+        memcpy(pEntry + offset, &t, sizeof(T));
         offset += sizeof(T);
     }
 
-    void encodeValue(buffer_type &buffer, size_t &offset, const std::string &s)
+private:
+    struct pending_frame
     {
-        encodeValue(buffer, offset, s.size());
-        memcpy(buffer.data() + offset, s.data(), s.size());
-        offset += s.size();
-    }
+        buffer_type data;
+        uint32_t    recordCount = 0;
+    };
 
 private:
-    asio::io_service        ioService_;
-    asio::ip::tcp::socket   socket_;
-    std::mutex              mutex;
-    //static thread_local ring_buffer buffer_;
-    oqpi::thread_interface<>  senderThread_;
+    const config                                config_;
+    const uint32_t                              slot_;              // In the thread local states
+    asio::io_service                            ioService_;
+    asio::ip::tcp::socket                       socket_;
+    // Replaces the socket for the frames when the server accepted it
+    std::unique_ptr<shared_memory_ring>         spSharedMemory_;
+    std::atomic<bool>                           running_;
+    // Reported to the server so far
+    std::atomic<uint64_t>                       droppedRecords_;
+    std::mutex                                  stagingBuffersMutex_;
+    staging_buffers                             stagingBuffers_;
+    staging_buffers                             drainedBuffers_;    // Only accessed by the sender thread
+    mpsc_ring_buffer                            sharedStagingBuffer_;
+    std::atomic<uint64_t>                       sharedDroppedRecords_;
+    std::mutex                                  namesMutex_;
+    std::unordered_map<std::string, uint32_t>   nameIds_;
+    std::vector<std::string>                    names_;
+    std::atomic<uint32_t>                       nameCount_;
+    uint32_t                                    sentNameCount_;
+    // Only accessed by the sender thread
+    std::array<pending_frame, opcode::count>    pendingFrames_;
+    size_t                                      pendingSize_;
+    std::chrono::steady_clock::time_point       oldestPendingRecord_;
+    buffer_type                                 outgoing_;
+    task_column_codec                           taskCodec_;
+    oqpi::thread_interface<>                    senderThread_;
 };
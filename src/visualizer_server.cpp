@@ -1,9 +1,129 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include "oqpi.hpp"
-#include "visualizer_server.hpp"
+#include "live_view_server.hpp"
+#include "chrome_trace_writer.hpp"
 
-int main()
+// Usage: oqpi_telemetry_server [--capture <directory>] [--replay <file> [--max-speed] [--from <ms>]]
+//        oqpi_telemetry_server --export-chrome <capture file> <json file>
+//  --capture       records every session to a capture file in the given directory
+//  --replay        replays a capture file as a new session, with its original timing unless --max-speed
+//  --from          starts the replay at the given number of milliseconds after the first task
+//  --export-chrome converts a capture file to the Chrome trace event format and exits
+
+int exportChromeTrace(const char *capturePath, const char *jsonPath)
+{
+    try
+    {
+        capture_reader reader(capturePath);
+        std::ofstream ofs(jsonPath, std::ios::binary);
+        if (!ofs)
+        {
+            throw std::runtime_error(std::string("cannot create ") + jsonPath);
+        }
+
+        chrome_trace_writer writer(ofs);
+        replay_capture(reader, [&writer](const uint8_t *data, size_t size)
+        {
+            writer.process(data, size);
+        }, false);
+        writer.finish();
+        if (!ofs)
+        {
+            throw std::runtime_error(std::string("cannot write to ") + jsonPath);
+        }
+
+        std::cout << writer.eventCount() << " events exported to " << jsonPath << std::endl;
+        return 0;
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Export failed: " << e.what() << std::endl;
+        return 1;
+    }
+}
+
+int main(int argc, char **argv)
 {
+    if (argc == 4 && strcmp(argv[1], "--export-chrome") == 0)
+    {
+        return exportChromeTrace(argv[2], argv[3]);
+    }
+
+    visualizer_server::config cfg;
+    std::string replayPath;
+    auto realTime = true;
+    uint64_t fromMs = 0;
+    for (auto i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+        {
+            cfg.captureDirectory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            replayPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--max-speed") == 0)
+        {
+            realTime = false;
+        }
+        else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc)
+        {
+            fromMs = strtoull(argv[++i], nullptr, 10);
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--capture <directory>] [--replay <file> [--max-speed] [--from <ms>]]" << std::endl;
+            std::cerr << "       " << argv[0] << " --export-chrome <capture file> <json file>" << std::endl;
+            return 1;
+        }
+    }
+
     asio::io_service io_service;
-    visualizer_server server(io_service);
+    visualizer_server server(io_service, cfg);
+    // Browsers connect there to watch the sessions live
+    live_view_server liveView(io_service, server);
+
+    asio::signal_set signals(io_service, SIGINT, SIGTERM);
+    signals.async_wait([&server, &liveView](const asio::error_code &error, int)
+    {
+        if (!error)
+        {
+            liveView.stop();
+            server.stop();
+        }
+    });
+
+    // A fixed amount of threads serves all the sessions
+    const auto threadCount = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (auto i = 1u; i < threadCount; ++i)
+    {
+        threads.emplace_back([&io_service] { io_service.run(); });
+    }
+
+    // The replayed session stays available to the live view until the server is stopped
+    if (!replayPath.empty())
+    {
+        threads.emplace_back([&server, &replayPath, realTime, fromMs]
+        {
+            try
+            {
+                server.replay(replayPath, realTime, fromMs);
+                std::cout << "Replay of " << replayPath << " done" << std::endl;
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "Replay failed: " << e.what() << std::endl;
+            }
+        });
+    }
     io_service.run();
-}
\ No newline at end of file
+
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+}
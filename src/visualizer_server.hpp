@@ -1,143 +1,856 @@
 #pragma once
 
+#include <mutex>
+#include <atomic>
+#include <memory>
 #include <thread>
+#include <vector>
+#include <functional>
+#include <string>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <array>
+#include <unordered_map>
 
 #define ASIO_STANDALONE
 #include "asio.hpp"
 
-#include "timer_contexts.hpp"
-
-using buffer_type = std::vector<uint8_t>;
+#include "histogram.hpp"
+#include "capture_file.hpp"
+#include "event_store.hpp"
+#include "interval_index.hpp"
+#include "frame_decoder.hpp"
+#include "frame_reader.hpp"
+#include "shared_memory_ring.hpp"
+#include "task_hierarchy.hpp"
+#include "tile_pyramid.hpp"
+#include "telemetry_protocol.hpp"
 
 //--------------------------------------------------------------------------------------------------
 class telemetry
 {
 public:
-    void process(const buffer_type &buffer)
+    struct config
+    {
+        // Statistics are printed on that period, zero disables the periodic report
+        std::chrono::milliseconds reportPeriod = std::chrono::milliseconds(1000);
+        // Retention of the recorded events
+        event_store::config store;
+        // Resolutions of the timeline
+        tile_pyramid::config timeline;
+    };
+
+public:
+    telemetry()
+        : telemetry(config())
+    {}
+
+    explicit telemetry(const config &cfg)
+        : config_(cfg)
+        , store_(cfg.store)
+        , corePyramid_(lane_kind::core, cfg.timeline)
+        , threadPyramid_(lane_kind::thread, cfg.timeline)
+        , lastReport_(std::chrono::steady_clock::now())
+    {}
+
+    // Decodes a whole frame, header included, the data is only read during the call.
+    // Frames are processed by the session's strand, queries can come from any thread.
+    // Returns the range of the timestamps of the tasks in the frame.
+    frame_tick_range process(const uint8_t *data, size_t size)
+    {
+        std::lock_guard<std::mutex> __l(mutex_);
+
+        struct visitor
+        {
+            telemetry           &t;
+            frame_tick_range    tasks;
+
+            void onClock(const clock_record &cr)
+            {
+                t.ticksPerSecond_ = cr.ticksPerSecond;
+            }
+
+            void onName(uint32_t nameId, const char *name, uint16_t length)
+            {
+                if (nameId >= t.names_.size())
+                {
+                    t.names_.resize(nameId + 1);
+                }
+                t.names_[nameId].assign(name, length);
+            }
+
+            void onGroup(const group_info &gi)
+            {
+                t.hierarchy_.addGroup(gi);
+            }
+
+            void onTask(const task_info &ti)
+            {
+                tasks.add(ti);
+                t.storeEvent(ti);
+                t.recordDuration(ti);
+                t.recordWait(ti);
+            }
+
+            void onSteal(const steal_info &si)
+            {
+                t.recordSteal(si);
+            }
+
+            void onDropped(const dropped_info &di)
+            {
+                t.droppedCount_ += di.count;
+            }
+        };
+
+        visitor v{ *this, frame_tick_range() };
+        decoder_.decode(data, size, v);
+
+        if (config_.reportPeriod.count() > 0)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            if (now - lastReport_ >= config_.reportPeriod)
+            {
+                lastReport_ = now;
+                printReport(std::cout);
+            }
+        }
+        return v.tasks;
+    }
+
+    // Prints the duration statistics gathered since the beginning of the connection
+    void report(std::ostream &os) const
     {
-        uint16_t msgSize = 0;
-        size_t offset = 0;
-        task_info ti;
-        std::string name;
+        std::lock_guard<std::mutex> __l(mutex_);
+        printReport(os);
+    }
 
-        decode(buffer, offset, msgSize, ti, name);
-        oqpi_check(msgSize == buffer.size());
+    // Level of detail view of [fromNs, toNs), timestamps being in nanoseconds of the client's clock
+    timeline queryTimeline(uint64_t fromNs, uint64_t toNs, uint32_t bucketCount, lane_kind kind) const
+    {
+        std::lock_guard<std::mutex> __l(mutex_);
+        return (kind == lane_kind::core ? corePyramid_ : threadPyramid_).query(fromNs, toNs, bucketCount);
+    }
 
-        taskNames_[ti.uid] = name;
-        tasks_[ti.uid] = ti;
-        printDuration(ti, ti.uid);
+    // Stored tasks that ran during [fromNs, toNs), by increasing start time, at most maxCount of them
+    std::vector<event_store::event> tasksOverlapping(uint64_t fromNs, uint64_t toNs, size_t maxCount) const
+    {
+        std::lock_guard<std::mutex> __l(mutex_);
+        std::vector<event_store::event> events;
+        index_.forEachOverlapping(fromNs, toNs, [this, &events, maxCount](const interval_index::entry &e)
+        {
+            if (events.size() >= maxCount)
+            {
+                return false;
+            }
+            events.push_back(store_.at(e.sequence));
+            return true;
+        });
+        return events;
+    }
+
+    // Stored tasks running at the given time, on all cores
+    std::vector<event_store::event> tasksRunningAt(uint64_t ns, size_t maxCount) const
+    {
+        return tasksOverlapping(ns, ns + 1, maxCount);
+    }
+
+    // Stop time of the most recent task, in nanoseconds
+    uint64_t lastTimestamp() const
+    {
+        std::lock_guard<std::mutex> __l(mutex_);
+        return store_.lastStop();
+    }
+
+    // Names are only ever appended, this returns the ones from firstNameId onward
+    std::vector<std::string> namesFrom(uint32_t firstNameId) const
+    {
+        std::lock_guard<std::mutex> __l(mutex_);
+        return firstNameId < names_.size()
+            ? std::vector<std::string>(names_.begin() + firstNameId, names_.end())
+            : std::vector<std::string>();
     }
 
 private:
-    void printDuration(const task_info &ti, oqpi::task_uid uid)
+    void printReport(std::ostream &os) const
+    {
+        os << "-------------------------------------------------------------------" << "\n";
+        os << taskCount_ << " tasks, durations in microseconds" << "\n";
+        if (droppedCount_ > 0)
+        {
+            os << droppedCount_ << " records were dropped by the client, its staging buffers were full" << "\n";
+        }
+        printHeader(os, "name");
+        for (uint32_t nameId = 0; nameId < uint32_t(nameStats_.size()); ++nameId)
+        {
+            printStats(os, getName(nameId), nameStats_[nameId]);
+        }
+        if (!groupStats_.empty())
+        {
+            printHeader(os, "group");
+            for (const auto &entry : groupStats_)
+            {
+                printStats(os, getPathName(entry.first), entry.second);
+            }
+        }
+        if (scheduledCount_ > 0)
+        {
+            os << scheduledCount_ << " tasks went through the queue, waits in microseconds" << "\n";
+            printHeader(os, "name");
+            for (uint32_t nameId = 0; nameId < uint32_t(nameWaits_.size()); ++nameId)
+            {
+                printStats(os, getName(nameId), nameWaits_[nameId]);
+            }
+            static const char *priorityNames[] = { "high", "above_normal", "normal", "below_normal", "low" };
+            static_assert(sizeof(priorityNames) / sizeof(priorityNames[0]) == size_t(oqpi::task_priority::count), "missing priority name");
+            printHeader(os, "priority");
+            for (size_t priority = 0; priority < priorityWaits_.size(); ++priority)
+            {
+                printStats(os, priorityNames[priority], priorityWaits_[priority]);
+            }
+        }
+        if (stealCount_ > 0)
+        {
+            os << stealCount_ << " steals" << "\n";
+            os  << std::left << std::setw(48) << "thread" << std::right
+                << std::setw(12) << "stole"
+                << std::setw(14) << "robbed"
+                << "\n";
+            for (const auto &entry : threadSteals_)
+            {
+                os  << std::left << std::setw(48) << entry.first << std::right
+                    << std::setw(12) << entry.second.stole
+                    << std::setw(14) << entry.second.robbed
+                    << "\n";
+            }
+        }
+        os << std::flush;
+    }
+
+    void storeEvent(const task_info &ti)
     {
-        std::cout
-            << getFullName(ti)
-            << " ended after "
-            << duration(ti.startedAt, ti.stoppedAt)
-            << "ms"
-            << std::endl;
+        const auto startNs = toNanoseconds(ti.startedAt);
+        const auto stopNs = toNanoseconds(ti.stoppedAt);
+        // Depending on its telemetry policy, the client may not capture cores or threads
+        if (ti.startedOnCore != unknown_core)
+        {
+            corePyramid_.add(ti.startedOnCore, startNs, stopNs, ti.nameId);
+        }
+        if (ti.startedOnThread != unknown_thread)
+        {
+            threadPyramid_.add(ti.startedOnThread, startNs, stopNs, ti.nameId);
+        }
+
+        const auto sequence = store_.append(ti, startNs, stopNs, [this](const event_store::chunk &c)
+        {
+            // A group is done once its own record is in, nothing refers to it past that point
+            for (uint32_t i = 0; i < c.count; ++i)
+            {
+                hierarchy_.removeGroup(c.uid[i]);
+            }
+        });
+        index_.prune(store_.firstSequence());
+        index_.insert(startNs, stopNs, sequence);
     }
 
-    std::string getFullName(const task_info &ti)
+    // Per name and per parent group path, the memory used doesn't depend on the number of tasks
+    void recordDuration(const task_info &ti)
     {
-        std::string fullName;
+        ++taskCount_;
+        if (ti.nameId >= names_.size())
+        {
+            return;
+        }
+
+        const auto duration = toNanoseconds(ti.stoppedAt - ti.startedAt);
+        if (ti.nameId >= nameStats_.size())
+        {
+            nameStats_.resize(names_.size());
+        }
+        nameStats_[ti.nameId].record(duration);
+
         if (ti.groupUID != oqpi::invalid_task_uid)
         {
-            auto it = tasks_.find(ti.groupUID);
-            if (it != tasks_.end())
+            groupStats_[hierarchy_.groupPath(ti.groupUID)].record(duration);
+        }
+    }
+
+    // Time spent in the queue of the scheduler, per name and per priority
+    void recordWait(const task_info &ti)
+    {
+        if (ti.scheduledAt == not_scheduled || ti.scheduledAt > ti.startedAt)
+        {
+            return;
+        }
+
+        ++scheduledCount_;
+        const auto wait = toNanoseconds(ti.startedAt - ti.scheduledAt);
+        if (ti.nameId < names_.size())
+        {
+            if (ti.nameId >= nameWaits_.size())
             {
-                fullName = getFullName(tasks_[ti.groupUID]) + "/";
+                nameWaits_.resize(names_.size());
             }
+            nameWaits_[ti.nameId].record(wait);
+        }
+        if (ti.priority < priorityWaits_.size())
+        {
+            priorityWaits_[ti.priority].record(wait);
+        }
+    }
+
+    void recordSteal(const steal_info &si)
+    {
+        ++stealCount_;
+        ++threadSteals_[si.thief].stole;
+        ++threadSteals_[si.victim].robbed;
+    }
+
+    static void printHeader(std::ostream &os, const char *title)
+    {
+        os  << std::left << std::setw(48) << title << std::right
+            << std::setw(12) << "count"
+            << std::setw(14) << "p50"
+            << std::setw(14) << "p99"
+            << std::setw(14) << "max"
+            << "\n";
+    }
+
+    static void printStats(std::ostream &os, const std::string &name, const histogram &h)
+    {
+        if (h.count() == 0)
+        {
+            return;
         }
-        return fullName + taskNames_[ti.uid];
+
+        os  << std::left << std::setw(48) << name << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << h.count()
+            << std::setw(14) << h.valueAtPercentile(50.0) / 1000.0
+            << std::setw(14) << h.valueAtPercentile(99.0) / 1000.0
+            << std::setw(14) << h.max() / 1000.0
+            << "\n";
+    }
+
+    // Converts a number of ticks of the client's clock
+    uint64_t toNanoseconds(uint64_t ticks) const
+    {
+        return ticks_to_nanoseconds(ticks, ticksPerSecond_);
+    }
+
+    std::string getPathName(uint32_t pathId) const
+    {
+        return hierarchy_.pathName(pathId, [this](uint32_t nameId) -> const std::string& { return getName(nameId); });
     }
 
-    template<typename T, typename ..._Args>
-    void decode(const buffer_type &buffer, size_t &offset, T &t, _Args &...args)
+    const std::string& getName(uint32_t nameId) const
     {
-        decodeVar(buffer, offset, t);
-        decode(buffer, offset, args...);
+        static const std::string unknown = "<unknown>";
+        return nameId < names_.size() ? names_[nameId] : unknown;
     }
 
-    void decode(const buffer_type &buffer, size_t &offset)
+private:
+    struct steal_counts
+    {
+        uint64_t stole = 0;
+        uint64_t robbed = 0;
+    };
+
+private:
+    const config config_;
+    mutable std::mutex mutex_;
+    event_store store_;
+    interval_index index_;
+    tile_pyramid corePyramid_;
+    tile_pyramid threadPyramid_;
+    std::vector<std::string> names_;
+    std::vector<histogram> nameStats_;
+    task_hierarchy hierarchy_;
+    std::unordered_map<uint32_t, histogram> groupStats_;
+    uint64_t taskCount_ = 0;
+    uint64_t stealCount_ = 0;
+    uint64_t scheduledCount_ = 0;
+    uint64_t droppedCount_ = 0;
+    std::vector<histogram> nameWaits_;
+    std::array<histogram, size_t(oqpi::task_priority::count)> priorityWaits_;
+    std::map<steal_info::thread_id, steal_counts> threadSteals_;
+    std::chrono::steady_clock::time_point lastReport_;
+    frame_decoder decoder_;
+    // Nanoseconds until the client tells us otherwise
+    uint64_t ticksPerSecond_ = 1000000000ull;
+};
+//--------------------------------------------------------------------------------------------------
+
+
+//--------------------------------------------------------------------------------------------------
+// One connected client. All the handlers of a session run through its strand so that its telemetry
+// is never accessed concurrently even though the io_service is run by several threads.
+class session
+    : public std::enable_shared_from_this<session>
+{
+    // Longest wait of an empty shared memory ring, the client flushes every 10ms by default
+    static constexpr int max_shared_memory_poll_interval_ms = 8;
+
+public:
+    session(asio::io_service &ioService, asio::ip::tcp::socket socket, uint32_t id, std::function<void(session*)> onClosed)
+        : id_(id)
+        , socket_(std::move(socket))
+        , strand_(ioService)
+        , onClosed_(std::move(onClosed))
+        , sharedMemoryTimer_(ioService)
+        , sharedMemoryPollInterval_(0)
+        , sharedMemoryClosed_(false)
     {}
 
-    template<typename T>
-    void decodeVar(const buffer_type &buffer, size_t &offset, T &t)
+    ~session()
     {
-        memcpy(&t, buffer.data() + offset, sizeof(T));
-        offset += sizeof(T);
+        stopCapture();
+        telemetry_.report(std::cout);
+        onClosed_(this);
     }
 
-    void decodeVar(const buffer_type &buffer, size_t &offset, std::string &s)
+    uint32_t id() const
     {
-        size_t length = 0;
-        decodeVar(buffer, offset, length);
-        s.resize(length);
-        memcpy((void*)s.data(), buffer.data() + offset, length);
-        offset += length;
+        return id_;
+    }
+
+    const telemetry& getTelemetry() const
+    {
+        return telemetry_;
+    }
+
+    void start()
+    {
+        read();
+    }
+
+    // Records every frame received from now on to the given file, must be called before start()
+    void startCapture(const std::string &path)
+    {
+        try
+        {
+            capture_.reset(new capture_writer(path));
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "Capture disabled: " << e.what() << std::endl;
+        }
+    }
+
+    // Feeds a frame received by other means than the socket, e.g. replayed from a capture
+    void process(const uint8_t *data, size_t size)
+    {
+        telemetry_.process(data, size);
+    }
+
+    // Can be called from any thread
+    void close()
+    {
+        auto spSelf = shared_from_this();
+        strand_.post([spSelf]
+        {
+            asio::error_code error;
+            spSelf->socket_.shutdown(asio::ip::tcp::socket::shutdown_both, error);
+            spSelf->socket_.close(error);
+        });
     }
 
 private:
-    std::unordered_map<oqpi::task_uid, task_info> tasks_;
-    std::unordered_map<oqpi::task_uid, std::string> taskNames_;
+    // Reads as much as available, then processes all the complete frames in place
+    void read()
+    {
+        auto spSelf = shared_from_this();
+        if (spSharedMemory_)
+        {
+            pollSharedMemory();
+            waitForClose();
+            return;
+        }
+
+        socket_.async_read_some(asio::buffer(reader_.writePtr(), reader_.writableSize()), strand_.wrap(
+            [spSelf](const asio::error_code &error, size_t bytesRead)
+        {
+            if (spSelf->failed(error))
+            {
+                return;
+            }
+
+            try
+            {
+                spSelf->reader_.commit(bytesRead);
+                spSelf->reader_.parse([&spSelf](const uint8_t *data, size_t size)
+                {
+                    frame_header header;
+                    memcpy(&header, data, sizeof(header));
+                    if (header.op == opcode::attach_shared_memory)
+                    {
+                        spSelf->attachSharedMemory(data, size);
+                        return;
+                    }
+                    const auto tasks = spSelf->telemetry_.process(data, size);
+                    spSelf->capture(data, size, tasks);
+                });
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "Closing session: " << e.what() << std::endl;
+                return;
+            }
+
+            spSelf->read();
+        }));
+    }
+
+    // Maps the ring the client offered and answers whether it will be read, see telemetry_protocol.hpp
+    void attachSharedMemory(const uint8_t *data, size_t size)
+    {
+        shared_memory_record record;
+        if (size != sizeof(frame_header) + sizeof(record) || spSharedMemory_)
+        {
+            throw std::runtime_error("unexpected shared memory frame");
+        }
+        memcpy(&record, data + sizeof(frame_header), sizeof(record));
+        record.name[sizeof(record.name) - 1] = 0;
+
+        // Read from the next call to read(), once reader_ is not in use anymore
+        try
+        {
+            spSharedMemory_ = shared_memory_ring::open(record.name);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "Shared memory refused, using TCP: " << e.what() << std::endl;
+        }
+
+        static const uint8_t accepted = 1;
+        static const uint8_t refused = 0;
+        auto spSelf = shared_from_this();
+        asio::async_write(socket_, asio::buffer(spSharedMemory_ ? &accepted : &refused, 1), strand_.wrap(
+            [spSelf](const asio::error_code &, size_t)
+        {}));
+    }
+
+    // Frames come through shared memory: the ring is drained on the strand by the threads of the
+    // io_service, like the sockets, then polled again right away, or less and less often while it
+    // stays empty. Once the client is gone, what it wrote before disconnecting is drained and the
+    // polling stops.
+    void pollSharedMemory()
+    {
+        if (sharedMemoryClosed_)
+        {
+            while (drainSharedMemory() > 0)
+            {}
+            return;
+        }
+
+        sharedMemoryPollInterval_ = drainSharedMemory() > 0
+            ? 0
+            : std::min(std::max(sharedMemoryPollInterval_ * 2, 1), int(max_shared_memory_poll_interval_ms));
+
+        auto spSelf = shared_from_this();
+        sharedMemoryTimer_.expires_from_now(std::chrono::milliseconds(sharedMemoryPollInterval_));
+        sharedMemoryTimer_.async_wait(strand_.wrap([spSelf](const asio::error_code &)
+        {
+            spSelf->pollSharedMemory();
+        }));
+    }
+
+    // Processes what the ring holds, at most a buffer of it, returns the number of bytes read
+    size_t drainSharedMemory()
+    {
+        try
+        {
+            const auto size = spSharedMemory_->read(reader_.writePtr(), reader_.writableSize(), std::chrono::milliseconds(0));
+            reader_.commit(size);
+            reader_.parse([this](const uint8_t *data, size_t size)
+            {
+                const auto tasks = telemetry_.process(data, size);
+                capture(data, size, tasks);
+            });
+            return size;
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "Closing session: " << e.what() << std::endl;
+            sharedMemoryClosed_ = true;
+            close();
+            return 0;
+        }
+    }
+
+    // Frames come through shared memory, the socket only tells when the client is gone
+    void waitForClose()
+    {
+        auto spSelf = shared_from_this();
+        socket_.async_read_some(asio::buffer(closeProbe_), strand_.wrap(
+            [spSelf](const asio::error_code &error, size_t)
+        {
+            if (!spSelf->failed(error))
+            {
+                std::cerr << "Closing session: unexpected data on the socket" << std::endl;
+            }
+            spSelf->sharedMemoryClosed_ = true;
+            spSelf->sharedMemoryTimer_.cancel();
+        }));
+    }
+
+    // A failing capture doesn't affect the session
+    void capture(const uint8_t *data, size_t size, const frame_tick_range &tasks)
+    {
+        if (!capture_)
+        {
+            return;
+        }
+
+        try
+        {
+            capture_->append(data, size, tasks);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "Capture stopped: " << e.what() << std::endl;
+            capture_.reset();
+        }
+    }
+
+    void stopCapture()
+    {
+        if (!capture_)
+        {
+            return;
+        }
+
+        try
+        {
+            capture_->close();
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "Capture incomplete: " << e.what() << std::endl;
+        }
+        capture_.reset();
+    }
+
+    // Not issuing a new read lets the session die once the last handler referencing it is done
+    bool failed(const asio::error_code &error)
+    {
+        if (!error)
+        {
+            return false;
+        }
+
+        if (error != asio::error::eof && error != asio::error::operation_aborted)
+        {
+            std::cerr << "Closing session: " << error.message() << std::endl;
+        }
+        return true;
+    }
+
+private:
+    const uint32_t                          id_;
+    asio::ip::tcp::socket                   socket_;
+    asio::io_service::strand                strand_;
+    std::function<void(session*)>           onClosed_;
+    frame_reader                            reader_;
+    telemetry                               telemetry_;
+    std::unique_ptr<capture_writer>         capture_;
+    // Set when the client sends its frames through shared memory
+    std::unique_ptr<shared_memory_ring>     spSharedMemory_;
+    asio::steady_timer                      sharedMemoryTimer_;
+    int                                     sharedMemoryPollInterval_;  // Milliseconds
+    bool                                    sharedMemoryClosed_;
+    uint8_t                                 closeProbe_[1];
 };
 //--------------------------------------------------------------------------------------------------
 
 
 //--------------------------------------------------------------------------------------------------
+// Accepts clients asynchronously, the server does not own any thread: whoever runs the io_service
+// decides how many threads serve the sessions.
 class visualizer_server
 {
+public:
+    struct config
+    {
+        uint16_t    port        = 9000;
+        // Connections beyond that count are refused
+        size_t      maxSessions = 1024;
+        // When set, each session is recorded to a capture file in that directory
+        std::string captureDirectory;
+    };
+
 public:
     visualizer_server(asio::io_service &ioService)
-        : acceptor_(ioService, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), 9000))
+        : visualizer_server(ioService, config())
+    {}
+
+    visualizer_server(asio::io_service &ioService, const config &cfg)
+        : config_(cfg)
+        , ioService_(ioService)
+        , acceptor_(ioService, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), cfg.port))
+        , acceptedSocket_(ioService)
+        , lastSessionId_(0)
     {
-        for (;;)
+        accept();
+    }
+
+    // Returns the session with the given id, 0 meaning the most recent one
+    std::shared_ptr<session> findSession(uint32_t id)
+    {
+        std::shared_ptr<session> spFound;
+        for (auto &spSession : liveSessions())
         {
-            asio::ip::tcp::socket sock(ioService);
-            acceptor_.accept(sock);
-            std::thread([](asio::ip::tcp::socket sock)
+            if (spSession->id() == id || (id == 0 && (!spFound || spSession->id() > spFound->id())))
             {
-                telemetry t;
-                try
+                spFound = spSession;
+            }
+        }
+        return spFound;
+    }
+
+    // Replays a capture file into a new session, blocks until the whole capture was processed.
+    // The session then stays available to the live view until the server is stopped. A non zero
+    // fromMs skips the chunks of tasks that stopped earlier than that after the first task.
+    void replay(const std::string &path, bool realTime, uint64_t fromMs = 0)
+    {
+        capture_reader reader(path);
+        size_t firstChunk = 0;
+        if (fromMs > 0)
+        {
+            const auto ticksPerSecond = reader.ticksPerSecond();
+            if (ticksPerSecond == 0)
+            {
+                throw std::runtime_error("cannot seek in a capture without name table: " + path);
+            }
+            const auto ticks = fromMs / 1000 * ticksPerSecond + fromMs % 1000 * ticksPerSecond / 1000;
+            firstChunk = reader.firstChunkAt(reader.firstTicks() + ticks);
+        }
+
+        auto spSession = makeSession(asio::ip::tcp::socket(ioService_));
+        {
+            std::lock_guard<std::mutex> __l(sessionsMutex_);
+            sessions_.emplace(spSession.get(), spSession);
+            offlineSessions_.push_back(spSession);
+        }
+
+        replay_capture(reader, [&spSession](const uint8_t *data, size_t size)
+        {
+            spSession->process(data, size);
+        }, realTime, firstChunk);
+    }
+
+    // Stops accepting and closes all the live sessions, run() returns once they are all gone
+    void stop()
+    {
+        ioService_.post([this]
+        {
+            asio::error_code error;
+            acceptor_.close(error);
+        });
+
+        for (auto &spSession : liveSessions())
+        {
+            spSession->close();
+        }
+
+        // Released outside of the lock, see liveSessions()
+        std::vector<std::shared_ptr<session>> spOfflineSessions;
+        {
+            std::lock_guard<std::mutex> __l(sessionsMutex_);
+            spOfflineSessions.swap(offlineSessions_);
+        }
+    }
+
+private:
+    // Sessions unregister themselves when destroyed, the references returned here must be released
+    // outside of the lock
+    std::vector<std::shared_ptr<session>> liveSessions()
+    {
+        std::vector<std::shared_ptr<session>> spSessions;
+        std::lock_guard<std::mutex> __l(sessionsMutex_);
+        for (auto &entry : sessions_)
+        {
+            if (auto spSession = entry.second.lock())
+            {
+                spSessions.push_back(std::move(spSession));
+            }
+        }
+        return spSessions;
+    }
+
+    size_t sessionCount()
+    {
+        std::lock_guard<std::mutex> __l(sessionsMutex_);
+        return sessions_.size();
+    }
+
+    std::shared_ptr<session> makeSession(asio::ip::tcp::socket socket)
+    {
+        return std::make_shared<session>(ioService_, std::move(socket), ++lastSessionId_, [this](session *pSession)
+        {
+            std::lock_guard<std::mutex> __l(sessionsMutex_);
+            sessions_.erase(pSession);
+        });
+    }
+
+    // Connections are accepted into a bare socket, a session is only built for the ones that are kept
+    void accept()
+    {
+        acceptor_.async_accept(acceptedSocket_, [this](const asio::error_code &error)
+        {
+            if (error == asio::error::operation_aborted)
+            {
+                return;
+            }
+
+            if (!error)
+            {
+                if (sessionCount() < config_.maxSessions)
                 {
-                    for (;;)
+                    // Left ready for the next accept once moved from
+                    auto spSession = makeSession(std::move(acceptedSocket_));
+                    if (!config_.captureDirectory.empty())
+                    {
+                        spSession->startCapture(capturePath(spSession->id()));
+                    }
                     {
-                        buffer_type buffer(2);
-                        asio::error_code error;
-                        size_t length = sock.receive(asio::buffer(buffer));
-                        if (error == asio::error::eof)
-                            break; // Connection closed cleanly by peer.
-                        else if (error)
-                            throw asio::system_error(error); // Some other error.
-
-                        uint16_t bufferSize = *((uint16_t*)buffer.data());
-                        buffer.resize(bufferSize);
-                        size_t offset = 2;
-                        length = 0;
-                        while (length != bufferSize - 2)
-                        {
-                            length += sock.receive(asio::buffer(buffer.data() + offset, bufferSize - offset));
-                            if (error == asio::error::eof)
-                                break; // Connection closed cleanly by peer.
-                            else if (error)
-                                throw asio::system_error(error); // Some other error.
-                        }
-                        oqpi_check(length == bufferSize - 2);
-                        buffer.resize(bufferSize);
-                        t.process(buffer);
+                        std::lock_guard<std::mutex> __l(sessionsMutex_);
+                        sessions_.emplace(spSession.get(), spSession);
                     }
+                    spSession->start();
                 }
-                catch (std::exception& e)
+                else
                 {
-                    std::cerr << "Exception in thread: " << e.what() << "\n";
+                    std::cerr << "Refusing connection: too many sessions" << std::endl;
+                    asio::error_code ignored;
+                    acceptedSocket_.close(ignored);
                 }
-            }, std::move(sock)).detach();
-        }
+            }
+            else
+            {
+                std::cerr << "Accept failed: " << error.message() << std::endl;
+            }
+
+            accept();
+        });
+    }
+
+    std::string capturePath(uint32_t sessionId) const
+    {
+        const auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        return config_.captureDirectory + "/session_" + std::to_string(now) + "_" + std::to_string(sessionId) + ".oqpicap";
     }
 
 private:
-    asio::ip::tcp::acceptor acceptor_;
+    const config                                        config_;
+    asio::io_service                                    &ioService_;
+    asio::ip::tcp::acceptor                             acceptor_;
+    asio::ip::tcp::socket                               acceptedSocket_;
+    std::mutex                                          sessionsMutex_;
+    std::unordered_map<session*, std::weak_ptr<session>> sessions_;
+    // Replayed sessions, they don't have any handler keeping them alive
+    std::vector<std::shared_ptr<session>>               offlineSessions_;
+    std::atomic<uint32_t>                               lastSessionId_;
 };
 //--------------------------------------------------------------------------------------------------
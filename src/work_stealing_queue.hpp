@@ -0,0 +1,384 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "cqueue.hpp"
+
+
+// Default observer of work_stealing_queue, steals go unnoticed
+struct null_steal_observer
+{
+    // Identifies the thread owning a deque, given back to on_steal
+    static uint64_t thread_tag()
+    {
+        return 0;
+    }
+
+    // Called by the thief, right after it stole an element from the deque of victimTag
+    static void on_steal(uint64_t /*victimTag*/)
+    {}
+};
+
+
+// Work stealing queue, usable as the queue of oqpi::scheduler.
+//
+// Every thread popping from the queue, i.e. every worker, gets a Chase-Lev deque of its own the
+// first time it does so. From then on, what it pushes goes to its deque and it pops from it in LIFO
+// order: the tasks a worker spawns run on that worker, while its caches are still warm.
+// When its deque is empty, a worker looks at the injection queue, in which the threads that never
+// pop (the main thread for instance) push, then steals the oldest element of the other deques.
+// A full deque spills over into the injection queue.
+//
+// Elements are moved in and out of the cells of the deques, nothing is allocated once a worker has
+// its deque. A thief only reads a cell once it won it, and the owner doesn't reuse a cell until
+// the thief that won it is done moving the element out, a push spills over to the injection queue
+// instead.
+// A thread gives its slot back when it exits, the next thread that pops takes it over along with
+// the deque and whatever was left in it. At most _MaxWorkers threads have a deque at the same time,
+// the others only use the injection queue.
+template <typename T, typename _StealObserver = null_steal_observer, size_t _DequeCapacity = 1024, size_t _MaxWorkers = 64>
+class work_stealing_queue
+{
+    static_assert(_DequeCapacity >= 2 && (_DequeCapacity & (_DequeCapacity - 1)) == 0, "capacity must be a power of two");
+
+    static constexpr size_t cache_line_size = 64;
+
+public:
+    work_stealing_queue()
+        : dequeCount_(0)
+        , spSlots_(std::make_shared<slot_registry>())
+    {
+        for (auto &d : deques_)
+        {
+            d.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~work_stealing_queue()
+    {
+        spSlots_->closed.store(true, std::memory_order_relaxed);
+        for (auto &d : deques_)
+        {
+            std::unique_ptr<deque> spDeque(d.load(std::memory_order_relaxed));
+            T t;
+            while (spDeque && spDeque->pop(t))
+            {}
+        }
+    }
+
+    work_stealing_queue(const work_stealing_queue &) = delete;
+    work_stealing_queue& operator=(const work_stealing_queue &) = delete;
+
+    void push(T &&t)
+    {
+        emplace(std::move(t));
+    }
+
+    void push(const T &t)
+    {
+        emplace(t);
+    }
+
+    bool try_pop(T &v)
+    {
+        const auto slot = workerSlot();
+        auto pDeque = ownDeque(slot);
+        if (pDeque && pDeque->pop(v))
+        {
+            return true;
+        }
+        return injection_.try_pop(v) || steal(slot, v);
+    }
+
+    // Only a hint when other threads push or pop concurrently
+    bool empty() const
+    {
+        if (!injection_.empty())
+        {
+            return false;
+        }
+        const auto dequeCount = std::min(dequeCount_.load(std::memory_order_acquire), _MaxWorkers);
+        for (size_t i = 0; i < dequeCount; ++i)
+        {
+            const auto pDeque = deques_[i].load(std::memory_order_acquire);
+            if (pDeque && !pDeque->empty())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    struct cell
+    {
+        T                       value;
+        std::atomic<bool>       occupied;
+    };
+
+    // Chase-Lev deque of fixed capacity, as formalized for C11 atomics by Lê et al.
+    // push() and pop() are only called by the owner, steal() by anybody else.
+    struct deque
+    {
+        explicit deque(uint64_t tag)
+            : top(0)
+            , bottom(0)
+            , ownerTag(tag)
+        {
+            for (auto &c : cells)
+            {
+                c.occupied.store(false, std::memory_order_relaxed);
+            }
+        }
+
+        template<typename U>
+        bool push(U &&u)
+        {
+            const auto b = bottom.load(std::memory_order_relaxed);
+            const auto t = top.load(std::memory_order_acquire);
+            auto &c = cells[b & mask];
+            if (b - t >= int64_t(_DequeCapacity) || c.occupied.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            c.value = std::forward<U>(u);
+            c.occupied.store(true, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(T &v)
+        {
+            const auto b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto t = top.load(std::memory_order_relaxed);
+
+            if (t > b)
+            {
+                // Empty
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+
+            if (t == b)
+            {
+                // Last one, race against thieves
+                const auto won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_relaxed);
+                if (!won)
+                {
+                    return false;
+                }
+            }
+            take(cells[b & mask], v);
+            return true;
+        }
+
+        bool steal(T &v)
+        {
+            auto t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const auto b = bottom.load(std::memory_order_acquire);
+            if (t >= b)
+            {
+                return false;
+            }
+
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                // Lost against the owner or another thief
+                return false;
+            }
+            take(cells[t & mask], v);
+            return true;
+        }
+
+        bool empty() const
+        {
+            return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+        }
+
+        // Only called by whoever won the cell, which the owner may push to again once released
+        static void take(cell &c, T &v)
+        {
+            v = std::move(c.value);
+            c.occupied.store(false, std::memory_order_release);
+        }
+
+        static constexpr int64_t mask = int64_t(_DequeCapacity - 1);
+
+        std::atomic<int64_t>    top;
+        uint8_t                 padding0[cache_line_size - sizeof(int64_t)];
+        std::atomic<int64_t>    bottom;
+        uint8_t                 padding1[cache_line_size - sizeof(int64_t)];
+        cell                    cells[_DequeCapacity];
+        // Changes when the slot of the deque is taken over by another thread
+        std::atomic<uint64_t>   ownerTag;
+    };
+
+    // Slots of the deques of a queue, shared with the threads holding one so that they can give
+    // them back when they exit, whether the queue is still there or not
+    struct slot_registry
+    {
+        slot_registry()
+            : slotCount(0)
+            , closed(false)
+        {}
+
+        std::mutex              mutex;
+        std::vector<size_t>     freeSlots;
+        size_t                  slotCount;
+        std::atomic<bool>       closed;     // The queue is gone
+    };
+
+    // The slots a thread holds, one per queue it popped from
+    struct thread_slots
+    {
+        using entry = std::pair<std::shared_ptr<slot_registry>, size_t>;
+
+        ~thread_slots()
+        {
+            for (auto &entry : entries)
+            {
+                std::lock_guard<std::mutex> __l(entry.first->mutex);
+                entry.first->freeSlots.push_back(entry.second);
+            }
+        }
+
+        std::vector<entry>      entries;
+    };
+
+private:
+    template<typename U>
+    void emplace(U &&u)
+    {
+        const auto slot = currentWorkerSlot();
+        auto pDeque = slot < _MaxWorkers ? deques_[slot].load(std::memory_order_relaxed) : nullptr;
+        // A full deque leaves u untouched
+        if (!pDeque || !pDeque->push(std::forward<U>(u)))
+        {
+            injection_.push(std::forward<U>(u));
+        }
+    }
+
+    static thread_slots& threadSlots()
+    {
+        static thread_local thread_slots slots;
+        return slots;
+    }
+
+    // Index of the deque of the calling thread in this queue, SIZE_MAX until its first try_pop()
+    size_t currentWorkerSlot() const
+    {
+        for (const auto &entry : threadSlots().entries)
+        {
+            if (entry.first == spSlots_)
+            {
+                return entry.second;
+            }
+        }
+        return SIZE_MAX;
+    }
+
+    // Takes the lowest free slot, so that the deques in use stay first
+    size_t workerSlot()
+    {
+        auto slot = currentWorkerSlot();
+        if (slot != SIZE_MAX)
+        {
+            return slot;
+        }
+
+        {
+            std::lock_guard<std::mutex> __l(spSlots_->mutex);
+            auto &freeSlots = spSlots_->freeSlots;
+            if (freeSlots.empty())
+            {
+                slot = spSlots_->slotCount++;
+            }
+            else
+            {
+                const auto it = std::min_element(freeSlots.begin(), freeSlots.end());
+                slot = *it;
+                freeSlots.erase(it);
+            }
+        }
+
+        // Forget the queues that are gone, their slots don't matter anymore
+        auto &entries = threadSlots().entries;
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [](const typename thread_slots::entry &entry)
+        {
+            return entry.first->closed.load(std::memory_order_relaxed);
+        }), entries.end());
+        entries.emplace_back(spSlots_, slot);
+
+        if (slot < _MaxWorkers)
+        {
+            if (auto pDeque = deques_[slot].load(std::memory_order_relaxed))
+            {
+                pDeque->ownerTag.store(_StealObserver::thread_tag(), std::memory_order_relaxed);
+            }
+        }
+        return slot;
+    }
+
+    // Only the owner creates its deque, thieves only see it once it is published
+    deque* ownDeque(size_t slot)
+    {
+        if (slot >= _MaxWorkers)
+        {
+            return nullptr;
+        }
+
+        auto pDeque = deques_[slot].load(std::memory_order_relaxed);
+        if (pDeque == nullptr)
+        {
+            pDeque = new deque(_StealObserver::thread_tag());
+            deques_[slot].store(pDeque, std::memory_order_release);
+
+            // Keep track of the highest slot in use so that thieves don't go through all of them
+            auto dequeCount = dequeCount_.load(std::memory_order_relaxed);
+            while (dequeCount < slot + 1 && !dequeCount_.compare_exchange_weak(dequeCount, slot + 1, std::memory_order_release))
+            {}
+        }
+        return pDeque;
+    }
+
+    // Tries every other deque once, starting after the last one that was robbed
+    bool steal(size_t slot, T &v)
+    {
+        static thread_local size_t nextVictim = 0;
+
+        const auto dequeCount = std::min(dequeCount_.load(std::memory_order_acquire), _MaxWorkers);
+        for (size_t i = 0; i < dequeCount; ++i)
+        {
+            const auto victim = (nextVictim + i) % dequeCount;
+            if (victim == slot)
+            {
+                continue;
+            }
+
+            const auto pDeque = deques_[victim].load(std::memory_order_acquire);
+            if (pDeque && pDeque->steal(v))
+            {
+                nextVictim = victim;
+                _StealObserver::on_steal(pDeque->ownerTag.load(std::memory_order_relaxed));
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::atomic<deque*>                 deques_[_MaxWorkers];
+    std::atomic<size_t>                 dequeCount_;
+    std::shared_ptr<slot_registry>      spSlots_;
+    mpmc_queue<T>                       injection_;
+};